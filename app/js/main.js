@@ -375,16 +375,25 @@ class SandboxPage extends React.Component {
 
   handleMessage(msg) {
     var server_msg = JSON.parse(msg.data);
-    this.setState({circles: server_msg.circles,
-                   l1: server_msg.l1,
-                   l2: server_msg.l2,
-                   l3: server_msg.l3,
-                   l4: server_msg.l4,
-                   l5: server_msg.l5,
-                   l6: server_msg.l6,
-                   l7: server_msg.l7,
-                   l8: server_msg.l8});
+    // Density messages have no particles, so draw the estimate instead.
+    var parts = server_msg.circles ? server_msg : (server_msg.estimate || {});
+    this.setState({circles: parts.circles || [],
+                   l1: parts.l1 || [],
+                   l2: parts.l2 || [],
+                   l3: parts.l3 || [],
+                   l4: parts.l4 || [],
+                   l5: parts.l5 || [],
+                   l6: parts.l6 || [],
+                   l7: parts.l7 || [],
+                   l8: parts.l8 || []});
     NEW_MSG = true;
+
+    // The server stops updating once the filter has converged.
+    if (server_msg.converged) {
+      iter_count = server_msg.iteration;
+      clearInterval(interval);
+      inference_done = true;
+    }
   }
 
   handleAlgoSelect(event) {
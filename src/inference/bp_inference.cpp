@@ -0,0 +1,144 @@
+#include <algorithm>
+
+#include "bp_inference.h"
+#include "tracker.h"
+
+struct bp_tracker
+{
+  bp_tracker(const BPSandbox::TrackerOptions& options) :
+    tracker(options)
+  {
+  }
+
+  BPSandbox::Tracker tracker;
+};
+
+// Nothing may throw across the C interface, so any exception is reported
+// with NULL or -1 instead.
+
+bp_tracker* bp_tracker_create(size_t num_particles, const char* likelihood)
+{
+  try
+  {
+    BPSandbox::TrackerOptions options;
+    options.num_particles = num_particles;
+    if (likelihood != NULL) options.likelihood = likelihood;
+
+    return new bp_tracker(options);
+  }
+  catch (...)
+  {
+    return NULL;
+  }
+}
+
+void bp_tracker_destroy(bp_tracker* tracker)
+{
+  delete tracker;
+}
+
+int bp_tracker_set_image(bp_tracker* tracker, const unsigned char* pixels, size_t width, size_t height,
+                         size_t stride)
+{
+  if (tracker == NULL) return -1;
+
+  try
+  {
+    return tracker->tracker.setImage(pixels, width, height, stride) ? 0 : -1;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+}
+
+int bp_tracker_add_circle(bp_tracker* tracker, float x, float y, float radius)
+{
+  if (tracker == NULL) return -1;
+
+  try
+  {
+    tracker->tracker.addCircle(x, y, radius);
+    return 0;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+}
+
+int bp_tracker_add_rectangle(bp_tracker* tracker, float x, float y, float theta, float width, float height)
+{
+  if (tracker == NULL) return -1;
+
+  try
+  {
+    tracker->tracker.addRectangle(x, y, theta, width, height);
+    return 0;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+}
+
+int bp_tracker_init(bp_tracker* tracker)
+{
+  if (tracker == NULL) return -1;
+
+  try
+  {
+    return tracker->tracker.init() ? 0 : -1;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+}
+
+int bp_tracker_update(bp_tracker* tracker)
+{
+  if (tracker == NULL) return -1;
+
+  try
+  {
+    if (!tracker->tracker.update()) return -1;
+    return tracker->tracker.converged() ? 1 : 0;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+}
+
+int bp_tracker_estimate(const bp_tracker* tracker, bp_spider_pose* pose)
+{
+  if (tracker == NULL || pose == NULL) return -1;
+
+  BPSandbox::SpiderPose est;
+  try
+  {
+    if (!tracker->tracker.estimate(est)) return -1;
+  }
+  catch (...)
+  {
+    return -1;
+  }
+
+  pose->x = est.x;
+  pose->y = est.y;
+  pose->radius = est.radius;
+  pose->num_links = std::min<size_t>(est.links.size(), BP_MAX_LINKS);
+  for (size_t i = 0; i < pose->num_links; ++i)
+  {
+    pose->joints[i] = est.joints[i];
+    pose->links[i].x = est.links[i].x;
+    pose->links[i].y = est.links[i].y;
+    pose->links[i].theta = est.links[i].theta;
+    pose->links[i].width = est.links[i].width;
+    pose->links[i].height = est.links[i].height;
+  }
+  pose->log_likelihood = est.log_likelihood;
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef BP_SANDBOX_INFERENCE_BP_INFERENCE_H
+#define BP_SANDBOX_INFERENCE_BP_INFERENCE_H
+
+/*
+ * C interface of the bp_inference library, a thin wrapper of the Tracker
+ * class for callers which can't use C++. Functions which can fail return 0
+ * on success and -1 on failure.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BP_MAX_LINKS 8
+
+typedef struct bp_tracker bp_tracker;
+
+typedef struct bp_link_pose
+{
+  float x, y, theta;
+  float width, height;
+} bp_link_pose;
+
+typedef struct bp_spider_pose
+{
+  float x, y, radius;
+  size_t num_links;
+  float joints[BP_MAX_LINKS];
+  bp_link_pose links[BP_MAX_LINKS];
+  double log_likelihood;
+} bp_spider_pose;
+
+/**
+ * Create a tracker with the default options.
+ * @param num_particles The number of particles.
+ * @param likelihood    The likelihood name, "sdf", "chamfer", "iou" or
+ *                      "average", or NULL for "sdf".
+ * @return              The tracker, or NULL on failure.
+ */
+bp_tracker* bp_tracker_create(size_t num_particles, const char* likelihood);
+
+void bp_tracker_destroy(bp_tracker* tracker);
+
+/**
+ * Set the image, one byte per pixel by rows, nonzero being occupied. The
+ * pixels are copied. A stride of 0 means the rows are packed.
+ */
+int bp_tracker_set_image(bp_tracker* tracker, const unsigned char* pixels, size_t width, size_t height,
+                         size_t stride);
+
+int bp_tracker_add_circle(bp_tracker* tracker, float x, float y, float radius);
+int bp_tracker_add_rectangle(bp_tracker* tracker, float x, float y, float theta, float width, float height);
+
+int bp_tracker_init(bp_tracker* tracker);
+
+/**
+ * Run one update.
+ * @return 1 if the filter has converged, 0 if not, or -1 on failure.
+ */
+int bp_tracker_update(bp_tracker* tracker);
+
+int bp_tracker_estimate(const bp_tracker* tracker, bp_spider_pose* pose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BP_SANDBOX_INFERENCE_BP_INFERENCE_H
@@ -0,0 +1,149 @@
+#ifndef BP_SANDBOX_INFERENCE_COMMON_BITMASK_H
+#define BP_SANDBOX_INFERENCE_COMMON_BITMASK_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace BPSandbox
+{
+
+inline int popcount64(const uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(word);
+#else
+  uint64_t v = word - ((word >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Bits set in a word for the columns in [begin, end) of the word starting at
+ * column word_col.
+ */
+inline uint64_t columnBits(const int word_col, const int begin, const int end)
+{
+  int lo = std::max(0, begin - word_col);
+  int hi = std::min(64, end - word_col);
+  if (hi <= lo) return 0;
+
+  uint64_t bits = hi == 64 ? ~0ULL : (1ULL << hi) - 1;
+  return bits & ~((1ULL << lo) - 1);
+}
+
+/**
+ * Bit-packed binary image, one bit per pixel and 64 pixels per word. A mask
+ * can cover a window of a larger image. The window starts on a multiple of
+ * 64 columns, so its words line up with the words of a full image mask.
+ */
+class BitMask
+{
+public:
+  BitMask() :
+    col0_(0),
+    row0_(0),
+    width_(0),
+    height_(0),
+    words_per_row_(0)
+  {
+  }
+
+  /**
+   * Clear the mask and make it cover a window.
+   * @param col0   The first column. It is rounded down to a multiple of 64.
+   * @param row0   The first row.
+   * @param width  The number of columns from col0.
+   * @param height The number of rows.
+   */
+  void reset(const int col0, const int row0, const int width, const int height)
+  {
+    col0_ = col0 >= 0 ? col0 / 64 * 64 : (col0 - 63) / 64 * 64;
+    row0_ = row0;
+    width_ = std::max(0, col0 + width - col0_);
+    height_ = std::max(0, height);
+    words_per_row_ = (width_ + 63) / 64;
+    words_.assign(words_per_row_ * height_, 0);
+  }
+
+  int col0() const { return col0_; }
+  int row0() const { return row0_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int wordsPerRow() const { return words_per_row_; }
+
+  bool contains(const int col, const int row) const
+  {
+    return col >= col0_ && col < col0_ + width_ && row >= row0_ && row < row0_ + height_;
+  }
+
+  void set(const int col, const int row)
+  {
+    if (!contains(col, row)) return;
+    int c = col - col0_;
+    words_[(row - row0_) * words_per_row_ + c / 64] |= 1ULL << (c % 64);
+  }
+
+  void clear(const int col, const int row)
+  {
+    if (!contains(col, row)) return;
+    int c = col - col0_;
+    words_[(row - row0_) * words_per_row_ + c / 64] &= ~(1ULL << (c % 64));
+  }
+
+  /**
+   * Set the bits of the columns [begin, end) of a row, clipped to the mask.
+   */
+  void setSpan(const int row, const int begin, const int end)
+  {
+    if (row < row0_ || row >= row0_ + height_) return;
+
+    int b = std::max(begin, col0_);
+    int e = std::min(end, col0_ + width_);
+    uint64_t* words = &words_[(row - row0_) * words_per_row_];
+
+    for (int word_col = col0_ + (b - col0_) / 64 * 64; word_col < e; word_col += 64)
+    {
+      words[(word_col - col0_) / 64] |= columnBits(word_col, b, e);
+    }
+  }
+
+  bool get(const int col, const int row) const
+  {
+    if (!contains(col, row)) return false;
+    int c = col - col0_;
+    return (words_[(row - row0_) * words_per_row_ + c / 64] >> (c % 64)) & 1;
+  }
+
+  /**
+   * The word holding the 64 columns starting at an absolute column, which
+   * must be a multiple of 64. Words outside the mask are empty.
+   */
+  uint64_t word(const int word_col, const int row) const
+  {
+    if (row < row0_ || row >= row0_ + height_) return 0;
+    int k = (word_col - col0_) / 64;
+    if (word_col < col0_ || k >= words_per_row_) return 0;
+    return words_[(row - row0_) * words_per_row_ + k];
+  }
+
+  /**
+   * The words of a row inside the mask, starting at column col0().
+   */
+  const uint64_t* row(const int row) const
+  {
+    return &words_[(row - row0_) * words_per_row_];
+  }
+
+private:
+  int col0_, row0_;
+  int width_, height_;
+  int words_per_row_;
+  std::vector<uint64_t> words_;
+};
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_COMMON_BITMASK_H
@@ -0,0 +1,270 @@
+#include "inference_utils.h"
+
+namespace BPSandbox
+{
+
+double effectiveSampleSize(const std::vector<double>& normalized_weights)
+{
+  double sum_sq = 0;
+  for (auto& w : normalized_weights) sum_sq += w * w;
+
+  if (sum_sq == 0) return 0;
+  return 1.0 / sum_sq;
+}
+
+std::vector<size_t> importanceSample(const size_t num_particles,
+                                     const std::vector<double>& normalized_weights,
+                                     std::mt19937& gen, const bool keep_best)
+{
+  std::vector<size_t> sample_ind;
+
+  if (num_particles < 1 || normalized_weights.size() < 1) return sample_ind;
+
+  if (keep_best)
+  {
+    size_t max_idx = 0;
+    for (size_t i = 1; i < normalized_weights.size(); ++i)
+    {
+      if (normalized_weights[i] > normalized_weights[max_idx])
+      {
+        max_idx = i;
+      }
+    }
+    sample_ind.push_back(max_idx);
+  }
+
+  std::uniform_real_distribution<float> distribution(0.0, 1.0);
+
+  while (sample_ind.size() < num_particles)
+  {
+    float r = distribution(gen);
+    int idx = 0;
+    float sum = normalized_weights[idx];
+    while (sum < r) {
+      ++idx;
+      sum += normalized_weights[idx];
+    }
+    sample_ind.push_back(idx);
+  }
+
+  return sample_ind;
+}
+
+std::vector<size_t> lowVarianceSample(const size_t num_particles,
+                                      const std::vector<double>& normalized_weights,
+                                      std::mt19937& gen)
+{
+  std::vector<size_t> sample_ind;
+
+  if (num_particles < 1 || normalized_weights.size() < 1) return sample_ind;
+
+  std::uniform_real_distribution<float> distribution(0.0, 1.0 / num_particles);
+  float r = distribution(gen);
+  int idx = 0;
+  float sum = normalized_weights[idx];
+
+  for (size_t i = 0; i < num_particles; ++i)
+  {
+    float u = r + i * (1. / num_particles);
+    while (u > sum)
+    {
+      idx++;
+      sum += normalized_weights[idx];
+    }
+    sample_ind.push_back(idx);
+  }
+
+  return sample_ind;
+}
+
+size_t kldSampleSize(const size_t num_bins, const double epsilon, const double z)
+{
+  if (num_bins < 2) return 1;
+
+  double k = num_bins - 1;
+  double a = 2 / (9 * k);
+  double b = 1 - a + sqrt(a) * z;
+
+  return static_cast<size_t>(std::ceil(k / (2 * epsilon) * b * b * b));
+}
+
+long long particleBin(const spider::SpiderParticle& particle, const float bin_pix,
+                      const float bin_angle)
+{
+  long long bx = static_cast<long long>(std::floor(particle.x / bin_pix));
+  long long by = static_cast<long long>(std::floor(particle.y / bin_pix));
+  long long bt = static_cast<long long>(std::floor(normalize_angle(particle.joints[0]) / bin_angle));
+
+  return (bx & 0xfffff) | ((by & 0xfffff) << 20) | ((bt & 0xfffff) << 40);
+}
+
+std::vector<size_t> kldSample(const std::vector<double>& normalized_weights,
+                              const std::vector<long long>& bins,
+                              const size_t min_particles, const size_t max_particles,
+                              const double epsilon, const double z, std::mt19937& gen)
+{
+  std::vector<size_t> sample_ind;
+
+  if (max_particles < 1 || normalized_weights.size() < 1) return sample_ind;
+
+  std::vector<double> cdf(normalized_weights.size());
+  std::partial_sum(normalized_weights.begin(), normalized_weights.end(), cdf.begin());
+
+  std::uniform_real_distribution<double> distribution(0.0, cdf.back());
+
+  std::set<long long> occupied;
+  size_t needed = min_particles;
+
+  while (sample_ind.size() < std::max(needed, min_particles) && sample_ind.size() < max_particles)
+  {
+    size_t idx = std::upper_bound(cdf.begin(), cdf.end(), distribution(gen)) - cdf.begin();
+    idx = std::min(idx, cdf.size() - 1);
+    sample_ind.push_back(idx);
+
+    if (occupied.insert(bins[idx]).second)
+    {
+      needed = kldSampleSize(occupied.size(), epsilon, z);
+    }
+  }
+
+  return sample_ind;
+}
+
+std::vector<size_t> topWeightIndices(const std::vector<double>& weights, const size_t k)
+{
+  std::vector<size_t> idx(weights.size());
+  std::iota(idx.begin(), idx.end(), 0);
+
+  size_t num = std::min(k, idx.size());
+  std::partial_sort(idx.begin(), idx.begin() + num, idx.end(),
+                    [&weights](const size_t a, const size_t b) { return weights[a] > weights[b]; });
+  idx.resize(num);
+
+  return idx;
+}
+
+spider::ParticleList rootDensity(const spider::SpiderList& particles, const float cell_pix)
+{
+  std::map<std::pair<int, int>, int> counts;
+  for (auto& p : particles)
+  {
+    counts[{static_cast<int>(std::floor(p.x / cell_pix)),
+            static_cast<int>(std::floor(p.y / cell_pix))}]++;
+  }
+
+  spider::ParticleList density;
+  for (auto& c : counts)
+  {
+    density.push_back({(c.first.first + 0.5f) * cell_pix, (c.first.second + 0.5f) * cell_pix,
+                       static_cast<float>(c.second)});
+  }
+
+  return density;
+}
+
+spider::SpiderParticle jitterParticle(const spider::SpiderParticle& particle, const float jitter_pix,
+                                      const float jitter_angle, const float jitter_param,
+                                      std::mt19937& gen)
+{
+  std::normal_distribution<float> dpix{0, jitter_pix};
+  std::normal_distribution<float> dangle{0, jitter_angle};
+  std::normal_distribution<float> dparam{0, jitter_param};
+
+  std::vector<float> new_joints;
+  for (auto& j : particle.joints)
+  {
+    new_joints.push_back(j + dangle(gen));
+  }
+
+  spider::SpiderParticle new_particle(particle.x + dpix(gen), particle.y + dpix(gen),
+                                      particle.root.radius + dparam(gen),
+                                      particle.links[0].width + dparam(gen),
+                                      particle.links[0].height + dparam(gen),
+                                      new_joints);
+
+  return new_particle;
+}
+
+spider::SpiderList jitterParticles(const spider::SpiderList& particles,
+                                   const float jitter_pix, const float jitter_angle,
+                                   const float jitter_param, std::mt19937& gen)
+{
+  spider::SpiderList new_particles;
+
+  for (auto& p : particles)
+  {
+    new_particles.push_back(jitterParticle(p, jitter_pix, jitter_angle, jitter_param, gen));
+  }
+
+  return new_particles;
+}
+
+spider::SpiderList groundTruth(const Observation& obs)
+{
+  spider::SpiderList particles;
+  auto& gt = obs.getGroundTruth();
+
+  // A root row has three values and starts the next spider.
+  size_t start = 0;
+  while (start < gt.size())
+  {
+    size_t end = start + 1;
+    while (end < gt.size() && gt[end].size() != 3) end++;
+
+    const size_t num_joints = end - start - 1;
+    if (gt[start].size() != 3 || num_joints < 2 || num_joints % 2 != 0) return particles;
+
+    const float x = gt[start][1], y = gt[start][0];
+    const float w = gt[start + 1].size() > 3 ? gt[start + 1][3] : 27;
+    const float h = gt[start + 1].size() > 4 ? gt[start + 1][4] : 8;
+
+    std::vector<float> joints(num_joints);
+    for (size_t i = 0; i < num_joints; ++i)
+    {
+      const std::vector<float>& link = gt[start + i + 1];
+      if (link.size() < 2) return particles;
+
+      float cx = link[1], cy = link[0];
+      if (i < num_joints / 2)
+      {
+        joints[i] = normalize_angle(atan2(cy - y, cx - x));
+      }
+      else
+      {
+        // The second layer is relative to its parent, starting at the elbow.
+        float parent = joints[i - num_joints / 2];
+        float ex = x + 2 * w * cos(parent), ey = y + 2 * w * sin(parent);
+        joints[i] = normalize_angle(atan2(cy - ey, cx - ex) - parent);
+      }
+    }
+
+    particles.push_back(spider::SpiderParticle(x, y, gt[start][2], w, h, joints));
+    start = end;
+  }
+
+  return particles;
+}
+
+double poseError(const spider::SpiderParticle& estimate, const spider::SpiderParticle& gt)
+{
+  double error = sqrt((estimate.x - gt.x) * (estimate.x - gt.x) + (estimate.y - gt.y) * (estimate.y - gt.y));
+
+  const size_t half = gt.links.size() / 2;
+  for (size_t i = 0; i < gt.links.size(); ++i)
+  {
+    size_t start = i < half ? 0 : half;
+    size_t end = std::min(start + half, estimate.links.size());
+
+    double best = std::numeric_limits<double>::infinity();
+    for (size_t j = start; j < end; ++j)
+    {
+      float dx = estimate.links[j].x - gt.links[i].x, dy = estimate.links[j].y - gt.links[i].y;
+      best = std::min(best, static_cast<double>(sqrt(dx * dx + dy * dy)));
+    }
+    error += best;
+  }
+
+  return error / (gt.links.size() + 1);
+}
+
+}  // namespace BPSandbox
@@ -2,12 +2,16 @@
 #define BP_SANDBOX_INFERENCE_INFERENCE_UTILS_H
 
 #include <cmath>
+#include <cassert>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <numeric>
 #include <random>
+#include <limits>
 
 #include "common_utils.h"
 #include "spider_particle.h"
@@ -16,21 +20,23 @@ namespace BPSandbox
 {
 
 template <class T>
-static std::vector<double> normalizeVector(const std::vector<T>& vals, const bool log_likelihood = true)
+std::vector<double> normalizeVector(const std::vector<T>& vals, const bool log_likelihood = true)
 {
   std::vector<double> normalized_vals;
   if (vals.size() < 1) return normalized_vals;
 
   // Make sure vals are positive.
-  auto min_w = *std::min_element(vals.begin(), vals.end());
-  assert(log_likelihood || min_w >= 0);
+  assert(log_likelihood || *std::min_element(vals.begin(), vals.end()) >= 0);
+
+  // Log likelihoods are shifted by the largest one so exp() can't overflow.
+  auto max_w = *std::max_element(vals.begin(), vals.end());
 
   double sum = 0;
 
   for (auto& w : vals) {
     if (log_likelihood)
     {
-      sum += exp(w - min_w);
+      sum += exp(w - max_w);
     }
     else
     {
@@ -43,7 +49,7 @@ static std::vector<double> normalizeVector(const std::vector<T>& vals, const boo
       normalized_vals.push_back(1.0 / vals.size());
     } else {
       double new_w;
-      if (log_likelihood) new_w = exp(w - min_w) / sum;
+      if (log_likelihood) new_w = exp(w - max_w) / sum;
       else                new_w = w / sum;
       normalized_vals.push_back(new_w);
     }
@@ -52,111 +58,89 @@ static std::vector<double> normalizeVector(const std::vector<T>& vals, const boo
   return normalized_vals;
 }
 
-static std::vector<size_t> importanceSample(const size_t num_particles,
-                                            const std::vector<double>& normalized_weights,
-                                            const bool keep_best = true)
-{
-  std::vector<size_t> sample_ind;
-
-  if (num_particles < 1 || normalized_weights.size() < 1) return sample_ind;
-
-  if (keep_best)
-  {
-    size_t max_idx = 0;
-    for (size_t i = 1; i < normalized_weights.size(); ++i)
-    {
-      if (normalized_weights[i] > normalized_weights[max_idx])
-      {
-        max_idx = i;
-      }
-    }
-    sample_ind.push_back(max_idx);
-  }
-
-  std::random_device rd{};
-  std::mt19937 gen{rd()};
-  std::uniform_real_distribution<float> distribution(0.0, 1.0);
-
-  while (sample_ind.size() < num_particles)
-  {
-    float r = distribution(gen);
-    int idx = 0;
-    float sum = normalized_weights[idx];
-    while (sum < r) {
-      ++idx;
-      sum += normalized_weights[idx];
-    }
-    sample_ind.push_back(idx);
-  }
-
-  return sample_ind;
-}
-
-static std::vector<size_t> lowVarianceSample(const size_t num_particles,
-                                             const std::vector<double>& normalized_weights)
-{
-  std::vector<size_t> sample_ind;
-
-  if (num_particles < 1 || normalized_weights.size() < 1) return sample_ind;
-
-  std::random_device rd{};
-  std::mt19937 gen{rd()};
-  std::uniform_real_distribution<float> distribution(0.0, 1.0 / num_particles);
-  float r = distribution(gen);
-  int idx = 0;
-  float sum = normalized_weights[idx];
-
-  for (size_t i = 0; i < num_particles; ++i)
-  {
-    float u = r + i * (1. / num_particles);
-    while (u > sum)
-    {
-      idx++;
-      sum += normalized_weights[idx];
-    }
-    sample_ind.push_back(idx);
-  }
-
-  return sample_ind;
-}
-
-static spider::SpiderParticle jitterParticle(const spider::SpiderParticle& particle, const float jitter_pix,
-                                             const float jitter_angle, const float jitter_param)
-{
-  std::random_device rd{};
-  std::mt19937 gen{rd()};
-  std::normal_distribution<float> dpix{0, jitter_pix};
-  std::normal_distribution<float> dangle{0, jitter_angle};
-  std::normal_distribution<float> dparam{0, jitter_param};
-
-  std::vector<float> new_joints;
-  for (auto& j : particle.joints)
-  {
-    new_joints.push_back(j + dangle(gen));
-  }
-
-  spider::SpiderParticle new_particle(particle.x + dpix(gen), particle.y + dpix(gen),
-                                      particle.root.radius + dparam(gen),
-                                      particle.links[0].width + dparam(gen),
-                                      particle.links[0].height + dparam(gen),
-                                      new_joints);
-
-  return new_particle;
-}
-
-static spider::SpiderList jitterParticles(const spider::SpiderList& particles,
-                                          const float jitter_pix, const float jitter_angle,
-                                          const float jitter_param)
-{
-  spider::SpiderList new_particles;
-
-  for (auto& p : particles)
-  {
-    new_particles.push_back(jitterParticle(p, jitter_pix, jitter_angle, jitter_param));
-  }
-
-  return new_particles;
-}
+/**
+ * Effective sample size of a set of normalized weights, 1 / sum(w^2).
+ */
+double effectiveSampleSize(const std::vector<double>& normalized_weights);
+
+std::vector<size_t> importanceSample(const size_t num_particles,
+                                     const std::vector<double>& normalized_weights,
+                                     std::mt19937& gen, const bool keep_best = true);
+
+std::vector<size_t> lowVarianceSample(const size_t num_particles,
+                                      const std::vector<double>& normalized_weights,
+                                      std::mt19937& gen);
+
+/**
+ * Number of samples needed so that, with probability 1 - delta, the KL
+ * divergence between the sampled and true distributions is below epsilon,
+ * when the samples fall in num_bins bins (Fox, KLD-sampling).
+ * @param  num_bins The number of bins with support.
+ * @param  epsilon  The KL divergence bound.
+ * @param  z        The upper 1 - delta quantile of the standard normal.
+ */
+size_t kldSampleSize(const size_t num_bins, const double epsilon, const double z);
+
+/**
+ * Bin a particle by its root position and the angle of its first leg.
+ */
+long long particleBin(const spider::SpiderParticle& particle, const float bin_pix,
+                      const float bin_angle);
+
+/**
+ * Adaptive importance sampling. Samples are drawn until their number
+ * exceeds the KLD bound for the number of occupied bins, within the limits.
+ * @param  normalized_weights The normalized particle weights.
+ * @param  bins               The bin of each particle.
+ * @param  min_particles      The minimum number of samples.
+ * @param  max_particles      The maximum number of samples.
+ * @param  epsilon            The KL divergence bound.
+ * @param  z                  The upper 1 - delta quantile of the standard normal.
+ * @param  gen                The random number generator to draw from.
+ * @return                    The indices of the sampled particles.
+ */
+std::vector<size_t> kldSample(const std::vector<double>& normalized_weights,
+                              const std::vector<long long>& bins,
+                              const size_t min_particles, const size_t max_particles,
+                              const double epsilon, const double z, std::mt19937& gen);
+
+/**
+ * Indices of the k largest weights, largest first.
+ */
+std::vector<size_t> topWeightIndices(const std::vector<double>& weights, const size_t k);
+
+/**
+ * Histogram of the particle roots over square cells.
+ * @param  particles The particles.
+ * @param  cell_pix  The size of the cells, in pixels.
+ * @return           Each occupied cell as (x, y, count), at the cell center.
+ */
+spider::ParticleList rootDensity(const spider::SpiderList& particles, const float cell_pix);
+
+spider::SpiderParticle jitterParticle(const spider::SpiderParticle& particle, const float jitter_pix,
+                                      const float jitter_angle, const float jitter_param,
+                                      std::mt19937& gen);
+
+spider::SpiderList jitterParticles(const spider::SpiderList& particles,
+                                   const float jitter_pix, const float jitter_angle,
+                                   const float jitter_param, std::mt19937& gen);
+
+/**
+ * Build the ground truth spiders of an observation. The data file stores each
+ * spider as its root followed by its links, by center in (row, col) order, so
+ * the joint angles are recovered from where the link centers are.
+ * @param  obs The observation.
+ * @return     The ground truth spiders, or nothing if there is no ground truth.
+ */
+spider::SpiderList groundTruth(const Observation& obs);
+
+/**
+ * Mean distance between the shape centers of an estimate and the ground
+ * truth. The legs of a spider are interchangeable, so each ground truth link
+ * is matched with the closest link of the same layer in the estimate.
+ * @return The pose error, in pixels.
+ */
+double poseError(const spider::SpiderParticle& estimate, const spider::SpiderParticle& gt);
 
 };  // namespace BPSandbox
 
@@ -0,0 +1,9 @@
+#include "likelihood.h"
+
+namespace BPSandbox
+{
+
+const LikelihoodType ALL_LIKELIHOODS[4] = {LikelihoodType::SDF, LikelihoodType::CHAMFER,
+                                           LikelihoodType::IOU, LikelihoodType::AVERAGE};
+
+}  // namespace BPSandbox
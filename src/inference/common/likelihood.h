@@ -0,0 +1,175 @@
+#ifndef BP_SANDBOX_INFERENCE_COMMON_LIKELIHOOD_H
+#define BP_SANDBOX_INFERENCE_COMMON_LIKELIHOOD_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "observation.h"
+#include "spider_particle.h"
+
+namespace BPSandbox
+{
+
+/**
+ * How particles are scored against the observation.
+ */
+enum class LikelihoodType
+{
+  SDF,      // Overlap of the shapes with the occupied pixels.
+  CHAMFER,  // Distance of the shape boundaries to the observed edges.
+  IOU,      // Intersection over union in a window around the root.
+  AVERAGE   // Fraction of occupied pixels inside each shape.
+};
+
+extern const LikelihoodType ALL_LIKELIHOODS[4];
+
+inline const char* likelihoodName(const LikelihoodType type)
+{
+  switch (type)
+  {
+  case LikelihoodType::SDF: return "sdf";
+  case LikelihoodType::CHAMFER: return "chamfer";
+  case LikelihoodType::IOU: return "iou";
+  case LikelihoodType::AVERAGE: return "average";
+  }
+  return "unknown";
+}
+
+/**
+ * Look up a likelihood by name.
+ * @return True if the name is known.
+ */
+inline bool parseLikelihood(const std::string& name, LikelihoodType& type)
+{
+  for (auto& t : ALL_LIKELIHOODS)
+  {
+    if (name == likelihoodName(t))
+    {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Likelihood strategies. Each one scores a particle with a static function,
+// so a batch of particles is scored without any virtual calls, and the
+// choice of strategy is made once per batch in scoreParticles().
+//
+// Strategies which factor over the shapes of the spider also score the root
+// and a single link, so that moving one joint only rescores what it moved.
+// The score of a particle is then the sum of the scores of its shapes.
+
+struct SdfLikelihood
+{
+  static double score(const spider::SpiderParticle& p, const Observation& obs)
+  {
+    return p.sdf(obs);
+  }
+
+  static double root(const spider::Circle& c, const Observation& obs)
+  {
+    return log(c.sdf(obs));
+  }
+
+  static double link(const spider::Rectangle& r, const Observation& obs)
+  {
+    return log(r.sdf(obs));
+  }
+};
+
+struct ChamferLikelihood
+{
+  static double score(const spider::SpiderParticle& p, const Observation& obs)
+  {
+    return p.chamfer(obs);
+  }
+
+  static double root(const spider::Circle& c, const Observation& obs)
+  {
+    double d = c.chamfer(obs) / CHAMFER_SIGMA;
+    return -0.5 * d * d;
+  }
+
+  static double link(const spider::Rectangle& r, const Observation& obs)
+  {
+    double d = r.chamfer(obs) / CHAMFER_SIGMA;
+    return -0.5 * d * d;
+  }
+};
+
+struct IouLikelihood
+{
+  static double score(const spider::SpiderParticle& p, const Observation& obs)
+  {
+    return log(std::max(EPS, p.iou(obs)));
+  }
+};
+
+struct AverageLikelihood
+{
+  static double score(const spider::SpiderParticle& p, const Observation& obs)
+  {
+    return p.averageLikelihood(obs);
+  }
+
+  static double root(const spider::Circle& c, const Observation& obs)
+  {
+    int num_pts;
+    double sum = c.calcAverageVal(obs, num_pts);
+    return log(std::max(EPS, sum / std::max(1, num_pts)));
+  }
+
+  static double link(const spider::Rectangle& r, const Observation& obs)
+  {
+    int num_pts;
+    double sum = r.calcAverageVal(obs, num_pts);
+    return log(std::max(EPS, sum / std::max(1, num_pts)));
+  }
+};
+
+/**
+ * Score a batch of particles with one strategy.
+ */
+template <class Likelihood>
+std::vector<double> scoreParticles(const spider::SpiderList& particles, const Observation& obs)
+{
+  std::vector<double> weights;
+  weights.reserve(particles.size());
+
+  for (auto& p : particles) weights.push_back(Likelihood::score(p, obs));
+
+  return weights;
+}
+
+/**
+ * Score a batch of particles, choosing the strategy once for the batch.
+ */
+inline std::vector<double> scoreParticles(const LikelihoodType type, const spider::SpiderList& particles,
+                                          const Observation& obs)
+{
+  switch (type)
+  {
+  case LikelihoodType::CHAMFER: return scoreParticles<ChamferLikelihood>(particles, obs);
+  case LikelihoodType::IOU: return scoreParticles<IouLikelihood>(particles, obs);
+  case LikelihoodType::AVERAGE: return scoreParticles<AverageLikelihood>(particles, obs);
+  default: return scoreParticles<SdfLikelihood>(particles, obs);
+  }
+}
+
+/**
+ * Cost and accuracy of a likelihood on a set of particles.
+ */
+struct LikelihoodReport
+{
+  LikelihoodType type;
+  double cost_us;     // Scoring time per particle, in microseconds.
+  double pose_error;  // Pose error of the best scored particle, in pixels.
+  double gt_margin;   // Score of the ground truth minus the best score.
+};
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_COMMON_LIKELIHOOD_H
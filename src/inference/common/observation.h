@@ -1,36 +1,101 @@
 #ifndef BP_SANDBOX_INFERENCE_COMMON_OBSERVATION_H
 #define BP_SANDBOX_INFERENCE_COMMON_OBSERVATION_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <sstream>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <ctype.h>
 
+#include "spatial_index.h"
+#include "bitmask.h"
+#include "raster.h"
+
 namespace BPSandbox
 {
 
 class Observation
 {
 public:
+  /**
+   * An empty observation, until one is loaded or given.
+   */
   Observation() :
-    file_path_("/home/jana/code/bp-sandbox/data/obs.pbm"),
-    data_path_("/home/jana/code/bp-sandbox/data/obs_data.txt"),
+    width(0),
+    height(0),
+    num_occupied(0)
+  {
+  }
+
+  /**
+   * @param file_path The PBM image.
+   * @param data_path The blob and ground truth data of the image.
+   */
+  Observation(const std::string& file_path, const std::string& data_path) :
+    file_path_(file_path),
+    data_path_(data_path),
+    width(0),
+    height(0),
     num_occupied(0)
   {
     loadImage(file_path_);
     loadData(data_path_);
+    buildOccupancyMask();
+    buildPyramid(4);
+    computeDistanceTransform();
   }
 
-  ~Observation()
+  /**
+   * An observation of an image in memory, for callers which already hold
+   * the frame. The pixels are copied. There is no blob data until it is
+   * added with addCircle() and addRectangle().
+   * @param pixels The image, one byte per pixel by rows. Nonzero pixels are
+   *               occupied.
+   * @param width  The number of columns.
+   * @param height The number of rows.
+   * @param stride The number of bytes from one row to the next, or 0 if the
+   *               rows are packed.
+   */
+  Observation(const uint8_t* pixels, const size_t width, const size_t height, const size_t stride = 0) :
+    width(width),
+    height(height),
+    num_occupied(0)
   {
-    delete data_;
+    const size_t row_bytes = stride > 0 ? stride : width;
+    data_.assign(width * height, 0);
+
+    for (size_t row = 0; row < height; ++row)
+    {
+      const uint8_t* in = pixels + row * row_bytes;
+      for (size_t col = 0; col < width; ++col)
+      {
+        if (in[col] == 0) continue;
+        data_[row * width + col] = 1;
+        num_occupied++;
+      }
+    }
+
+    buildOccupancyMask();
+    buildPyramid(4);
+    computeDistanceTransform();
   }
 
   size_t width, height;
   int num_occupied;
 
+  /**
+   * Whether the image failed to load.
+   */
+  bool empty() const
+  {
+    return data_.empty();
+  }
+
   /**
    * Get the pixel value.
    * @param  i                 The column index.
@@ -62,29 +127,302 @@ public:
   void setPixel(const int i, const int j, const float val)
   {
     data_[j * width + i] = val;
+
+    if (val == 1.0) occupancy_.set(i, j);
+    else occupancy_.clear(i, j);
   }
 
-  std::vector<std::vector<float> > getCircles() const
+  /**
+   * The occupied pixels, packed 64 to a word.
+   */
+  const BitMask& occupancyMask() const
+  {
+    return occupancy_;
+  }
+
+  void buildOccupancyMask()
+  {
+    occupancy_.reset(0, 0, width, height);
+    for (int row = 0; row < height; ++row)
+    {
+      for (int col = 0; col < width; ++col)
+      {
+        if (isOccupied(col, row)) occupancy_.set(col, row);
+      }
+    }
+  }
+
+  /**
+   * The ground truth spiders, if the data file has any. Each spider is a row
+   * for the root as (row, col, radius) followed by a row per link as (row,
+   * col, theta, width, height), in the same convention as the detected blobs.
+   */
+  const std::vector<std::vector<float> >& getGroundTruth() const
+  {
+    return ground_truth_;
+  }
+
+  bool hasGroundTruth() const
+  {
+    return ground_truth_.size() > 0;
+  }
+
+  /**
+   * The detected circles, as (row, col, radius). Note that the row is the y
+   * coordinate of the image.
+   */
+  const std::vector<std::vector<float> >& getCircles() const
   {
     return circles_;
   }
 
-  std::vector<std::vector<float> > getRectangles() const
+  /**
+   * The detected rectangles, as (row, col, theta, width, height).
+   */
+  const std::vector<std::vector<float> >& getRectangles() const
   {
     return rectangles_;
   }
 
+  /**
+   * Add a detected circle, as (row, col, radius) like getCircles().
+   */
+  void addCircle(const std::vector<float>& circle)
+  {
+    if (circle.size() < 3) return;
+    circles_.push_back(circle);
+    circle_index_.insert(circle[1], circle[0]);
+  }
+
+  /**
+   * Add a detected rectangle, as (row, col, theta, width, height) like
+   * getRectangles().
+   */
+  void addRectangle(const std::vector<float>& rect)
+  {
+    if (rect.size() < 5) return;
+    rectangles_.push_back(rect);
+    rect_index_.insert(rect[1], rect[0]);
+  }
+
+  /**
+   * Spatial index over the circle centers in image (x, y) coordinates. The
+   * point indices match getCircles().
+   */
+  const GridIndex& circleIndex() const
+  {
+    return circle_index_;
+  }
+
+  /**
+   * Spatial index over the rectangle centers in image (x, y) coordinates.
+   * The point indices match getRectangles().
+   */
+  const GridIndex& rectangleIndex() const
+  {
+    return rect_index_;
+  }
+
+  /**
+   * Build an occupancy pyramid. Level l stores the number of occupied pixels
+   * in each 2^l x 2^l block of the image. Level 0 is the image itself, so it
+   * is read from the occupancy mask rather than stored again.
+   * @param num_levels The number of levels above the full resolution image.
+   */
+  void buildPyramid(const size_t num_levels)
+  {
+    pyramid_.clear();
+    pyramid_widths_.clear();
+
+    size_t prev_w = width, prev_h = height;
+    for (size_t l = 1; l <= num_levels; ++l)
+    {
+      size_t w = (prev_w + 1) / 2, h = (prev_h + 1) / 2;
+      std::vector<int> next(w * h, 0);
+
+      for (size_t row = 0; row < prev_h; ++row)
+      {
+        for (size_t col = 0; col < prev_w; ++col)
+        {
+          // Level 1 counts the pixels of the image.
+          int count = l == 1 ? (isOccupied(col, row) ? 1 : 0) : pyramid_.back()[row * prev_w + col];
+          next[(row / 2) * w + col / 2] += count;
+        }
+      }
+
+      pyramid_.push_back(next);
+      pyramid_widths_.push_back(w);
+      prev_w = w;
+      prev_h = h;
+    }
+  }
+
+  size_t pyramidLevels() const
+  {
+    return pyramid_.size() + 1;
+  }
+
+  /**
+   * Count the occupied pixels of a span, 64 at a time. Pixels out of bounds
+   * are free.
+   */
+  int countOccupied(const Span& span) const
+  {
+    int in_bounds;
+    return countSpan(span, in_bounds);
+  }
+
+  /**
+   * The number of pixels of a span inside the image.
+   */
+  int countInBounds(const Span& span) const
+  {
+    if (span.row < 0 || span.row >= height) return 0;
+    return std::max(0, std::min(static_cast<int>(width), span.end) - std::max(0, span.begin));
+  }
+
+  /**
+   * Count the occupied pixels of a span and the pixels inside the image in
+   * one pass, with the span clipped once.
+   * @param  span      The span.
+   * @param  in_bounds Set to the number of pixels of the span in the image.
+   * @return           The number of occupied pixels.
+   */
+  int countSpan(const Span& span, int& in_bounds) const
+  {
+    in_bounds = 0;
+    if (span.row < 0 || span.row >= height) return 0;
+
+    int begin = std::max(0, span.begin);
+    int end = std::min(static_cast<int>(width), span.end);
+    if (end <= begin) return 0;
+    in_bounds = end - begin;
+
+    // The occupancy mask covers the whole image, so its rows start at column 0.
+    const uint64_t* words = occupancy_.row(span.row);
+    int first = begin / 64, last = (end - 1) / 64;
+    if (first == last) return popcount64(words[first] & columnBits(first * 64, begin, end));
+
+    int count = popcount64(words[first] & (~0ULL << (begin % 64)));
+    for (int k = first + 1; k < last; ++k) count += popcount64(words[k]);
+    count += popcount64(words[last] & columnBits(last * 64, begin, end));
+
+    return count;
+  }
+
+  /**
+   * Upper bound on the number of occupied pixels in a region, computed from
+   * the pyramid cells which cover it.
+   * @param  level The pyramid level to use. Clamped to the highest level.
+   * @param  x0    The first column of the region.
+   * @param  y0    The first row of the region.
+   * @param  x1    One past the last column of the region.
+   * @param  y1    One past the last row of the region.
+   * @return       The number of occupied pixels in the covering cells.
+   */
+  int occupiedUpperBound(size_t level, int x0, int y0, int x1, int y1) const
+  {
+    level = std::min(level, pyramid_.size());
+
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(static_cast<int>(width), x1);
+    y1 = std::min(static_cast<int>(height), y1);
+    if (x0 >= x1 || y0 >= y1) return 0;
+
+    if (level == 0)
+    {
+      int count = 0;
+      for (int row = y0; row < y1; ++row) count += countOccupied(Span{row, x0, x1});
+      return count;
+    }
+
+    const std::vector<int>& cells = pyramid_[level - 1];
+    const int w = pyramid_widths_[level - 1];
+    int count = 0;
+    for (int row = y0 >> level; row <= (y1 - 1) >> level; ++row)
+    {
+      for (int col = x0 >> level; col <= (x1 - 1) >> level; ++col)
+      {
+        count += cells[row * w + col];
+      }
+    }
+
+    return count;
+  }
+
+  /**
+   * Euclidean distance from a pixel to the closest edge of the occupied
+   * regions. Out of bounds pixels are treated as the closest pixel in bounds.
+   * @param  i The column index.
+   * @param  j The row index.
+   * @return   The distance, in pixels.
+   */
+  float getDistance(int i, int j) const
+  {
+    if (distance_.size() < 1) return 0;
+
+    i = std::min(std::max(i, 0), static_cast<int>(width) - 1);
+    j = std::min(std::max(j, 0), static_cast<int>(height) - 1);
+
+    return distance_[j * width + i];
+  }
+
+  /**
+   * Compute the distance transform of the edges of the occupied regions, an
+   * occupied pixel being an edge if any of its four neighbours is free.
+   */
+  void computeDistanceTransform()
+  {
+    const float inf = 1e20;
+    distance_.assign(width * height, inf);
+
+    for (int row = 0; row < height; ++row)
+    {
+      for (int col = 0; col < width; ++col)
+      {
+        if (!isOccupied(col, row)) continue;
+
+        bool edge = col == 0 || row == 0 || col == width - 1 || row == height - 1 ||
+                    !isOccupied(col - 1, row) || !isOccupied(col + 1, row) ||
+                    !isOccupied(col, row - 1) || !isOccupied(col, row + 1);
+        if (edge) distance_[row * width + col] = 0;
+      }
+    }
+
+    // The squared distance transform is separable, so do the columns and
+    // then the rows (Felzenszwalb and Huttenlocher).
+    std::vector<float> f(std::max(width, height)), d(std::max(width, height));
+    for (size_t col = 0; col < width; ++col)
+    {
+      for (size_t row = 0; row < height; ++row) f[row] = distance_[row * width + col];
+      distanceTransform1D(f, d, height);
+      for (size_t row = 0; row < height; ++row) distance_[row * width + col] = d[row];
+    }
+    for (size_t row = 0; row < height; ++row)
+    {
+      for (size_t col = 0; col < width; ++col) f[col] = distance_[row * width + col];
+      distanceTransform1D(f, d, width);
+      for (size_t col = 0; col < width; ++col) distance_[row * width + col] = sqrt(d[col]);
+    }
+  }
+
 private:
 
-  float* data_;
-  std::vector<std::vector<float> > circles_, rectangles_;
+  std::vector<float> data_;
+  std::vector<float> distance_;
+  BitMask occupancy_;
+  // Levels 1 and up of the occupancy pyramid.
+  std::vector<std::vector<int> > pyramid_;
+  std::vector<int> pyramid_widths_;
+  std::vector<std::vector<float> > ground_truth_, circles_, rectangles_;
+  GridIndex circle_index_, rect_index_;
   std::string file_path_;
   std::string data_path_;
 
   void loadImage(const std::string& file_path)
   {
-    std::ifstream fin(file_path);
-    std::string line;
+    std::ifstream fin(file_path, std::ios::binary);
 
     if(!fin)
     {
@@ -92,30 +430,111 @@ private:
       return;
     }
 
-    // The first line can be ignored.
-    if (!std::getline(fin, line)) return;
-    // The second line has width and height.
-    if (std::getline(fin, line))
+    // Read the whole file at once, it is parsed much faster from memory.
+    std::string buffer((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    const char* p = buffer.data();
+    const char* end = p + buffer.size();
+
+    // The magic number is P1 for text images and P4 for packed binary ones.
+    if (buffer.size() < 2 || p[0] != 'P' || (p[1] != '1' && p[1] != '4'))
     {
-      std::stringstream ss(line);
-      ss >> width >> height;
+      std::cerr << "Observation " << file_path << " is not a PBM image." << std::endl;
+      return;
     }
-    else return;
+    const bool binary = p[1] == '4';
+    p += 2;
 
-    data_ = new float[width * height];
+    long w, h;
+    if (!readHeaderInt(p, end, w) || !readHeaderInt(p, end, h) || w <= 0 || h <= 0)
+    {
+      std::cerr << "Observation " << file_path << " has a bad header." << std::endl;
+      return;
+    }
+    width = w;
+    height = h;
+    // A single whitespace character separates the header from binary data.
+    if (binary && p < end) p++;
+
+    data_.assign(width * height, 0);
 
-    // Get the pixels.
     for (int row = 0; row < height; ++row)
     {
-      if (!std::getline(fin, line)) break;
-      std::stringstream ss(line);
       for (int col = 0; col < width; ++col)
       {
-        std::string pix;
-        ss >> pix;
-        data_[row * width + col] = std::stof(pix);
-        if (isOccupied(col, row)) num_occupied++;
+        bool occupied;
+        if (binary)
+        {
+          // Rows are packed 8 pixels to a byte, most significant bit first.
+          const char* byte = p + row * ((width + 7) / 8) + col / 8;
+          if (byte >= end) return;
+          occupied = (*byte >> (7 - col % 8)) & 1;
+        }
+        else
+        {
+          while (p < end && *p != '0' && *p != '1') p++;
+          if (p >= end) return;
+          occupied = *p++ == '1';
+        }
+
+        if (occupied)
+        {
+          data_[row * width + col] = 1;
+          num_occupied++;
+        }
+      }
+    }
+  }
+
+  /**
+   * Read a number from a PBM header, skipping whitespace and comments.
+   */
+  static bool readHeaderInt(const char*& p, const char* end, long& val)
+  {
+    while (p < end && (isspace(*p) || *p == '#'))
+    {
+      if (*p == '#') while (p < end && *p != '\n') p++;
+      else p++;
+    }
+    if (p >= end || !isdigit(*p)) return false;
+
+    val = 0;
+    while (p < end && isdigit(*p)) val = val * 10 + (*p++ - '0');
+    return true;
+  }
+
+
+  /**
+   * One dimensional squared distance transform of a sampled function, as the
+   * lower envelope of parabolas rooted at each sample.
+   */
+  static void distanceTransform1D(const std::vector<float>& f, std::vector<float>& d, const size_t n)
+  {
+    std::vector<int> v(n);
+    std::vector<float> z(n + 1);
+    int k = 0;
+    v[0] = 0;
+    z[0] = -1e20;
+    z[1] = 1e20;
+
+    for (int q = 1; q < n; ++q)
+    {
+      float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+      while (s <= z[k])
+      {
+        k--;
+        s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
       }
+      k++;
+      v[k] = q;
+      z[k] = s;
+      z[k + 1] = 1e20;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q)
+    {
+      while (z[k + 1] < q) k++;
+      d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
     }
   }
 
@@ -135,12 +554,28 @@ private:
       return;
     }
 
-    // Look for start of circle section.
-    do
+    // Look for start of circle section, reading the ground truth on the way.
+    bool in_gt = false;
+    while (true)
     {
       if (!std::getline(fin, line)) return;
-      trim(line);
-    } while (line != "CIRCLES");
+
+      std::string label = line;
+      trim(label);
+      if (label == "CIRCLES") break;
+      if (label == "GT")
+      {
+        in_gt = true;
+        continue;
+      }
+      if (!in_gt || label.empty()) continue;
+
+      std::stringstream ss(line);
+      std::vector<float> row;
+      float val;
+      while (ss >> val) row.push_back(val);
+      ground_truth_.push_back(row);
+    }
 
     if (!std::getline(fin, line)) return;
 
@@ -151,8 +586,7 @@ private:
       std::string x, y, r;
       ss >> x >> y >> r;
 
-      std::vector<float> circle({std::stof(x), std::stof(y), std::stof(r)});
-      circles_.push_back(circle);
+      addCircle({std::stof(x), std::stof(y), std::stof(r)});
 
       if (!std::getline(fin, line)) break;
     }
@@ -164,9 +598,7 @@ private:
       std::string x, y, theta, w, h;
       ss >> x >> y >> theta >> w >> h;
 
-      std::vector<float> rect({std::stof(x), std::stof(y), std::stof(theta),
-                               std::stof(w), std::stof(h)});
-      rectangles_.push_back(rect);
+      addRectangle({std::stof(x), std::stof(y), std::stof(theta), std::stof(w), std::stof(h)});
     }
   }
 };
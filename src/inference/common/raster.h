@@ -0,0 +1,134 @@
+#ifndef BP_SANDBOX_INFERENCE_COMMON_RASTER_H
+#define BP_SANDBOX_INFERENCE_COMMON_RASTER_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "bitmask.h"
+
+namespace BPSandbox
+{
+
+/**
+ * The pixels [begin, end) of one row covered by a shape.
+ */
+struct Span
+{
+  int row;
+  int begin, end;
+};
+
+typedef std::vector<Span> SpanList;
+
+/**
+ * Scanline fill of a circle. A pixel is covered if its center is within the
+ * radius of the center of the circle.
+ */
+inline void circleSpans(const float x, const float y, const float radius, SpanList& spans)
+{
+  const float r2 = radius * radius;
+  const int row_begin = static_cast<int>(std::ceil(y - radius));
+  const int row_end = static_cast<int>(std::floor(y + radius)) + 1;
+  spans.reserve(spans.size() + std::max(0, row_end - row_begin));
+
+  for (int row = row_begin; row < row_end; ++row)
+  {
+    float dy = row - y;
+    float half = std::sqrt(std::max(0.f, r2 - dy * dy));
+    int begin = static_cast<int>(std::ceil(x - half));
+    int end = static_cast<int>(std::floor(x + half)) + 1;
+
+    if (begin < end) spans.push_back({row, begin, end});
+  }
+}
+
+/**
+ * The half-plane of the points (x, y) with nx * x + ny * y <= offset.
+ */
+struct HalfPlane
+{
+  float nx, ny;
+  float offset;
+};
+
+/**
+ * Scanline fill of the intersection of half-planes within a bounding box. A
+ * pixel is covered if its center is inside every half-plane. The column
+ * limit of a half-plane moves by a constant step from one row to the next,
+ * so each row costs one addition per half-plane.
+ * @param planes The half-planes.
+ * @param min_x  The bounding box of the shape, which also clips the spans.
+ * @param spans  The spans are added to this list, one per covered row.
+ */
+template <size_t N>
+inline void halfPlaneSpans(const HalfPlane (&planes)[N], const float min_x, const float max_x,
+                           const float min_y, const float max_y, SpanList& spans)
+{
+  const int row_begin = static_cast<int>(std::ceil(min_y));
+  const int row_end = static_cast<int>(std::floor(max_y)) + 1;
+  spans.reserve(spans.size() + std::max(0, row_end - row_begin));
+
+  // Planes with a normal along y bound the rows rather than the columns. Their
+  // limit is how far the row is from leaving the plane.
+  float limit[N], step[N];
+  int side[N];
+  for (size_t i = 0; i < N; ++i)
+  {
+    const HalfPlane& p = planes[i];
+    if (std::abs(p.nx) < 1e-6f)
+    {
+      side[i] = 0;
+      limit[i] = p.offset - p.ny * row_begin;
+      step[i] = -p.ny;
+    }
+    else
+    {
+      side[i] = p.nx > 0 ? 1 : -1;
+      limit[i] = (p.offset - p.ny * row_begin) / p.nx;
+      step[i] = -p.ny / p.nx;
+    }
+  }
+
+  for (int row = row_begin; row < row_end; ++row)
+  {
+    float lo = min_x, hi = max_x;
+    bool outside = false;
+
+    for (size_t i = 0; i < N; ++i)
+    {
+      if (side[i] > 0)      hi = std::min(hi, limit[i]);
+      else if (side[i] < 0) lo = std::max(lo, limit[i]);
+      else if (limit[i] < 0) outside = true;
+      limit[i] += step[i];
+    }
+
+    if (outside || lo > hi) continue;
+
+    int begin = static_cast<int>(std::ceil(lo));
+    int end = static_cast<int>(std::floor(hi)) + 1;
+    if (begin < end) spans.push_back({row, begin, end});
+  }
+}
+
+/**
+ * The number of pixels covered by a list of spans.
+ */
+inline int spanArea(const SpanList& spans)
+{
+  int area = 0;
+  for (auto& s : spans) area += s.end - s.begin;
+  return area;
+}
+
+/**
+ * Set the bits of the pixels covered by a list of spans.
+ */
+inline void rasterizeSpans(const SpanList& spans, BitMask& mask)
+{
+  for (auto& s : spans) mask.setSpan(s.row, s.begin, s.end);
+}
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_COMMON_RASTER_H
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "snapshot.h"
+
+namespace BPSandbox
+{
+
+namespace
+{
+
+// Binary layout, in host byte order:
+//   char[4]  magic "BPPF"
+//   uint16   byte order mark 0x0102
+//   uint16   version
+//   uint32   number of joints
+//   uint64   update count
+//   uint64   configured number of particles
+//   uint64   number of stored particles, N
+//   N x float[5 + joints]  x, y, radius, w, h, joints
+//   N x double             weights
+//   uint8    1 if the last update resampled (version 2 and up)
+//   uint32   length of the RNG state, then the RNG state as text
+const char SNAPSHOT_MAGIC[4] = {'B', 'P', 'P', 'F'};
+const uint16_t SNAPSHOT_BOM = 0x0102;
+const uint16_t SNAPSHOT_VERSION = 2;
+
+template <class T>
+void writePod(std::ostream& out, const T& val)
+{
+  out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template <class T>
+bool readPod(std::istream& in, T& val)
+{
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&val), sizeof(T)));
+}
+
+}  // namespace
+
+bool writeSnapshot(const std::string& path, const FilterSnapshot& snapshot)
+{
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    std::cerr << "Error writing snapshot " << tmp_path << std::endl;
+    return false;
+  }
+
+  uint32_t num_joints = snapshot.particles.size() > 0 ? snapshot.particles[0].joints.size() : 0;
+
+  out.write(SNAPSHOT_MAGIC, 4);
+  writePod(out, SNAPSHOT_BOM);
+  writePod(out, SNAPSHOT_VERSION);
+  writePod(out, num_joints);
+  writePod(out, snapshot.update_count);
+  writePod(out, snapshot.num_particles);
+  writePod(out, static_cast<uint64_t>(snapshot.particles.size()));
+
+  std::vector<float> row(5 + num_joints);
+  for (auto& p : snapshot.particles)
+  {
+    row[0] = p.x;
+    row[1] = p.y;
+    row[2] = p.root.radius;
+    // The links clamp their width, so save the parameter they were built from.
+    row[3] = p.w;
+    row[4] = p.h;
+    std::copy(p.joints.begin(), p.joints.end(), row.begin() + 5);
+    out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+  }
+
+  out.write(reinterpret_cast<const char*>(snapshot.weights.data()), snapshot.weights.size() * sizeof(double));
+  writePod(out, static_cast<uint8_t>(snapshot.resampled ? 1 : 0));
+
+  writePod(out, static_cast<uint32_t>(snapshot.rng_state.size()));
+  out.write(snapshot.rng_state.data(), snapshot.rng_state.size());
+
+  out.close();
+  if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+  {
+    std::cerr << "Error writing snapshot " << path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool readSnapshot(const std::string& path, FilterSnapshot& snapshot, const uint32_t expected_joints)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+  {
+    std::cerr << "Error reading snapshot " << path << std::endl;
+    return false;
+  }
+
+  char magic[4];
+  uint16_t bom, version;
+  uint32_t num_joints;
+  uint64_t num_stored;
+
+  if (!in.read(magic, 4) || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0 ||
+      !readPod(in, bom) || bom != SNAPSHOT_BOM)
+  {
+    std::cerr << "Snapshot " << path << " is not a snapshot from this platform." << std::endl;
+    return false;
+  }
+
+  if (!readPod(in, version) || version > SNAPSHOT_VERSION)
+  {
+    std::cerr << "Snapshot " << path << " has unsupported version " << version << std::endl;
+    return false;
+  }
+
+  if (!readPod(in, num_joints) || !readPod(in, snapshot.update_count) ||
+      !readPod(in, snapshot.num_particles) || !readPod(in, num_stored)) return false;
+
+  if (num_stored > 0 && num_joints != expected_joints)
+  {
+    std::cerr << "Snapshot " << path << " has " << num_joints << " joints, expected "
+              << expected_joints << std::endl;
+    return false;
+  }
+
+  snapshot.particles.clear();
+  snapshot.particles.reserve(std::min<uint64_t>(num_stored, 1 << 20));
+
+  std::vector<float> row(5 + num_joints);
+  for (uint64_t i = 0; i < num_stored; ++i)
+  {
+    if (!in.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float))) return false;
+
+    std::vector<float> joints(row.begin() + 5, row.end());
+    snapshot.particles.push_back(spider::SpiderParticle(row[0], row[1], row[2], row[3], row[4], joints));
+  }
+
+  snapshot.weights.resize(num_stored);
+  if (!in.read(reinterpret_cast<char*>(snapshot.weights.data()), num_stored * sizeof(double))) return false;
+
+  // Older snapshots don't say, so their weights start over.
+  uint8_t resampled = 1;
+  if (version >= 2 && !readPod(in, resampled)) return false;
+  snapshot.resampled = resampled != 0;
+
+  uint32_t rng_len;
+  // The text state of a std::mt19937 is a few kilobytes.
+  if (!readPod(in, rng_len) || rng_len > (1 << 16)) return false;
+  snapshot.rng_state.resize(rng_len);
+  if (!in.read(&snapshot.rng_state[0], rng_len)) return false;
+
+  return true;
+}
+
+}  // namespace BPSandbox
@@ -0,0 +1,45 @@
+#ifndef BP_SANDBOX_INFERENCE_COMMON_SNAPSHOT_H
+#define BP_SANDBOX_INFERENCE_COMMON_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "spider_particle.h"
+
+namespace BPSandbox
+{
+
+/**
+ * Everything needed to resume a particle filter.
+ */
+struct FilterSnapshot
+{
+  uint64_t update_count;
+  uint64_t num_particles;
+  spider::SpiderList particles;
+  std::vector<double> weights;
+  // Whether the last update resampled, so the weights start over.
+  bool resampled;
+  std::string rng_state;
+};
+
+/**
+ * Write a snapshot. The file is written next to the destination and then
+ * renamed, so a crash never leaves a partial snapshot behind.
+ * @return True if the snapshot was written.
+ */
+bool writeSnapshot(const std::string& path, const FilterSnapshot& snapshot);
+
+/**
+ * Read a snapshot written by writeSnapshot().
+ * @param  path            The snapshot file.
+ * @param  snapshot        The snapshot read.
+ * @param  expected_joints The number of joints the particles must have.
+ * @return                 True if the snapshot was read and is compatible.
+ */
+bool readSnapshot(const std::string& path, FilterSnapshot& snapshot, const uint32_t expected_joints);
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_COMMON_SNAPSHOT_H
@@ -0,0 +1,107 @@
+#ifndef BP_SANDBOX_INFERENCE_COMMON_SPATIAL_INDEX_H
+#define BP_SANDBOX_INFERENCE_COMMON_SPATIAL_INDEX_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+namespace BPSandbox
+{
+
+/**
+ * Uniform grid over 2D points, used to look up observed blobs near a
+ * location without scanning all of them.
+ */
+class GridIndex
+{
+public:
+  GridIndex(const float cell_size = 32) :
+    cell_size_(cell_size)
+  {
+  }
+
+  void clear()
+  {
+    cells_.clear();
+    xs_.clear();
+    ys_.clear();
+  }
+
+  /**
+   * Add a point to the index. Points are numbered in insertion order.
+   * @return The index of the point.
+   */
+  size_t insert(const float x, const float y)
+  {
+    cells_[key(cell(x), cell(y))].push_back(xs_.size());
+    xs_.push_back(x);
+    ys_.push_back(y);
+
+    return xs_.size() - 1;
+  }
+
+  size_t size() const
+  {
+    return xs_.size();
+  }
+
+  float x(const size_t idx) const
+  {
+    return xs_[idx];
+  }
+
+  float y(const size_t idx) const
+  {
+    return ys_[idx];
+  }
+
+  /**
+   * Find all the points within a radius of a location.
+   * @param  x      The query column.
+   * @param  y      The query row.
+   * @param  radius The search radius, in pixels.
+   * @return        The indices of the points in range.
+   */
+  std::vector<size_t> query(const float x, const float y, const float radius) const
+  {
+    std::vector<size_t> found;
+
+    for (int cx = cell(x - radius); cx <= cell(x + radius); ++cx)
+    {
+      for (int cy = cell(y - radius); cy <= cell(y + radius); ++cy)
+      {
+        auto it = cells_.find(key(cx, cy));
+        if (it == cells_.end()) continue;
+
+        for (auto& idx : it->second)
+        {
+          float dx = xs_[idx] - x, dy = ys_[idx] - y;
+          if (dx * dx + dy * dy <= radius * radius) found.push_back(idx);
+        }
+      }
+    }
+
+    return found;
+  }
+
+private:
+  int cell(const float v) const
+  {
+    return static_cast<int>(std::floor(v / cell_size_));
+  }
+
+  uint64_t key(const int cx, const int cy) const
+  {
+    // Shifted as unsigned, since cells left of or above the image are negative.
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+  }
+
+  float cell_size_;
+  std::unordered_map<uint64_t, std::vector<size_t> > cells_;
+  std::vector<float> xs_, ys_;
+};
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_COMMON_SPATIAL_INDEX_H
@@ -12,9 +12,13 @@
 
 #include "common_utils.h"
 #include "observation.h"
+#include "bitmask.h"
+#include "raster.h"
 
 #define EPS 1e-4
-#define PER_PIX 0.1
+#define CHAMFER_STEP 2.0      // Spacing of the boundary samples, in pixels.
+#define CHAMFER_MAX_DIST 20.0 // Distances are truncated, in pixels.
+#define CHAMFER_SIGMA 4.0
 
 namespace BPSandbox
 {
@@ -25,6 +29,107 @@ typedef std::vector<std::vector<float> > ParticleList;
 typedef std::map<std::string, std::vector<float> > ParticleState;
 typedef std::map<std::string, ParticleList > ParticleStateList;
 
+/**
+ * The number of pixels of the box [x0, x1) x [y0, y1) outside the image.
+ */
+inline int outsideArea(const Observation& obs, const int x0, const int y0, const int x1, const int y1)
+{
+  const int w = static_cast<int>(obs.width), h = static_cast<int>(obs.height);
+  const int in_w = std::max(0, std::min(w, x1) - std::max(0, x0));
+  const int in_h = std::max(0, std::min(h, y1) - std::max(0, y0));
+
+  return (x1 - x0) * (y1 - y0) - in_w * in_h;
+}
+
+/**
+ * Upper bound on the SDF score of a shape. The score counts occupied pixels
+ * inside the shape minus free ones, so it is at most 2 * occupied - inside.
+ * Only pixels in the image count as inside, so the pixels of the bounding box
+ * outside the image are taken off the area.
+ * @param  occupied Upper bound on the occupied pixels inside the shape.
+ * @param  area     The area of the shape.
+ * @param  margin   The most the number of pixels inside can differ from area.
+ * @param  outside  The number of pixels of the bounding box outside the image.
+ * @param  max_area The normalization area of the shape.
+ */
+inline double coarseBound(const int occupied, const float area, const float margin,
+                          const int outside, const float max_area)
+{
+  double inside_lo = std::max(0.f, area - margin - outside);
+  double inside_hi = area + margin;
+  double bound = std::min(inside_hi, 2 * occupied - inside_lo);
+
+  return std::max(EPS, bound / max_area);
+}
+
+/**
+ * SDF score of a shape from its spans: the occupied pixels inside it minus
+ * the free ones, normalized by the largest area of the shape. The pixels are
+ * counted as integers, so only the final ratio is floating point.
+ */
+inline float spanSdf(const Observation& obs, const SpanList& spans, const float max_area)
+{
+  int inside = 0, occupied = 0;
+  for (auto& s : spans)
+  {
+    int in_bounds;
+    occupied += obs.countSpan(s, in_bounds);
+    inside += in_bounds;
+  }
+
+  float sdf = (2 * occupied - inside) / max_area;
+
+  return std::max(static_cast<float>(EPS), sdf);
+}
+
+/**
+ * Sum of the observation over the spans of a shape.
+ * @param  num_pts The number of pixels in the spans, in bounds or not.
+ */
+inline double spanSum(const Observation& obs, const SpanList& spans, int& num_pts)
+{
+  int sum = 0;
+  num_pts = spanArea(spans);
+  for (auto& s : spans) sum += obs.countOccupied(s);
+
+  return sum;
+}
+
+/**
+ * Sum of the logs of positive factors, taking one log for a batch of factors
+ * instead of one per factor. The factors are multiplied in a float until the
+ * product gets close to the float range, then the product is folded into the
+ * sum.
+ */
+class LogSum
+{
+public:
+  LogSum() :
+    product_(1),
+    sum_(0)
+  {
+  }
+
+  void add(const float factor)
+  {
+    product_ *= factor;
+    if (product_ < 1e-30f || product_ > 1e30f)
+    {
+      sum_ += std::log(product_);
+      product_ = 1;
+    }
+  }
+
+  double value() const
+  {
+    return sum_ + std::log(product_);
+  }
+
+private:
+  float product_;
+  double sum_;
+};
+
 class Circle
 {
 public:
@@ -53,61 +158,70 @@ public:
   float max_area;
   std::vector<float> radius_bounds;
 
-  double calcAverageVal(const Observation& obs, int& num_pts) const
+  /**
+   * The pixels covered by the circle, as row spans.
+   */
+  void spans(SpanList& out) const
   {
-    double sum = 0;
-    num_pts = 0;
-    for (int i = static_cast<int>(x - radius) - 1; i < static_cast<int>(x + radius) + 2; ++i)
-    {
-      for (int j = static_cast<int>(y - radius) - 1; j < static_cast<int>(y + radius) + 2; ++j)
-      {
-        if (pointInside(i, j))
-        {
-          num_pts++;
-          sum += obs.getPixel(i, j);
-        }
-      }
-    }
+    circleSpans(x, y, radius, out);
+  }
 
-    return sum;
+  double calcAverageVal(const Observation& obs, int& num_pts) const
+  {
+    SpanList s;
+    spans(s);
+    return spanSum(obs, s, num_pts);
   }
 
   double sdf(const Observation& obs) const
   {
-    double sdf = 0;
+    SpanList s;
+    spans(s);
+    return spanSdf(obs, s, max_area);
+  }
+
+  /**
+   * Upper bound on the SDF score, using the occupancy pyramid of the
+   * observation instead of visiting each pixel.
+   */
+  double coarseSdf(const Observation& obs, const size_t level) const
+  {
+    const int x0 = static_cast<int>(std::floor(x - radius));
+    const int y0 = static_cast<int>(std::floor(y - radius));
+    const int x1 = static_cast<int>(std::floor(x + radius)) + 1;
+    const int y1 = static_cast<int>(std::floor(y + radius)) + 1;
+    int occupied = obs.occupiedUpperBound(level, x0, y0, x1, y1);
+
+    // Every free pixel inside the shape counts against the score, so bound
+    // the number of pixels inside using the area and the perimeter.
+    float area = PI * radius * radius;
+    float margin = 2 * PI * radius + 4;
+
+    return coarseBound(occupied, area, margin, outsideArea(obs, x0, y0, x1, y1), max_area);
+  }
 
-    int start_x = std::max(0, static_cast<int>(std::floor(x - radius)));
-    int start_y = std::max(0, static_cast<int>(std::floor(y - radius)));
-    int end_x = std::min(static_cast<int>(obs.width), static_cast<int>(std::ceil(x + radius)));
-    int end_y = std::min(static_cast<int>(obs.height), static_cast<int>(std::ceil(y + radius)));
+  /**
+   * Mean distance from points along the boundary to the closest observed edge.
+   */
+  double chamfer(const Observation& obs) const
+  {
+    const int num_pts = std::max(8, static_cast<int>(std::ceil(2 * PI * radius / CHAMFER_STEP)));
+    double sum = 0;
 
-    for (int i = start_x; i < end_x; ++i)
+    for (int k = 0; k < num_pts; ++k)
     {
-      for (int j = start_y; j < end_y; ++j)
-      {
-        bool point_inside = pointInside(i, j);
-        if (point_inside)
-        {
-          if (obs.isOccupied(i, j))
-          {
-            sdf += PER_PIX;
-          }
-          else
-          {
-            sdf -= PER_PIX;
-          }
-        }
-      }
+      float angle = 2 * PI * k / num_pts;
+      float d = obs.getDistance(std::round(x + radius * cos(angle)), std::round(y + radius * sin(angle)));
+      sum += std::min(d, static_cast<float>(CHAMFER_MAX_DIST));
     }
 
-    sdf = sdf / (PER_PIX * max_area);
-
-    return std::max(EPS, sdf);
+    return sum / num_pts;
   }
 
   bool pointInside(const float pt_x, const float pt_y) const
   {
-    return pow(pt_x - x, 2) + pow(pt_y - y, 2) <= radius * radius;
+    float dx = pt_x - x, dy = pt_y - y;
+    return dx * dx + dy * dy <= radius * radius;
   }
 };
 
@@ -120,6 +234,11 @@ public:
     x(0),
     y(0),
     theta(0),
+    min_x(0),
+    max_x(0),
+    min_y(0),
+    max_y(0),
+    edges(),
     width_bounds({12, 42}),
     height_bounds({2, 15})
   {
@@ -131,6 +250,11 @@ public:
     x(x),
     y(y),
     theta(theta),
+    min_x(0),
+    max_x(0),
+    min_y(0),
+    max_y(0),
+    edges(),
     width_bounds({12, 42}),
     height_bounds({2, 15})
   {
@@ -146,102 +270,133 @@ public:
   float x, y, theta;
   float max_area;
   std::vector<std::vector<float> > corner_pts;
+  // The bounding box of the corners, and the edges as outward facing
+  // half-planes, both set by setPoints().
+  float min_x, max_x, min_y, max_y;
+  HalfPlane edges[4];
   std::vector<float> width_bounds, height_bounds;
 
-  double calcAverageVal(const Observation& obs, int& num_pts) const
+  /**
+   * The pixels covered by the rectangle, as row spans.
+   */
+  void spans(SpanList& out) const
   {
-    double sum = 0;
-    num_pts = 0;
-
-    for (int i = static_cast<int>(x - width) - 1; i < static_cast<int>(x + width) + 2; ++i)
-    {
-      for (int j = static_cast<int>(y - width) - 1; j < static_cast<int>(y + width) + 2; ++j)
-      {
-        if (pointInside(i, j))
-        {
-          num_pts++;
-          sum += obs.getPixel(i, j);
-        }
-      }
-    }
+    if (corner_pts.size() != 4) return;
+    halfPlaneSpans(edges, min_x, max_x, min_y, max_y, out);
+  }
 
-    return sum;
+  double calcAverageVal(const Observation& obs, int& num_pts) const
+  {
+    SpanList s;
+    spans(s);
+    return spanSum(obs, s, num_pts);
   }
 
   double sdf(const Observation& obs) const
   {
-    double sdf = 0;
+    SpanList s;
+    spans(s);
+    return spanSdf(obs, s, max_area);
+  }
+
+  /**
+   * Upper bound on the SDF score, using the occupancy pyramid of the
+   * observation over the bounding box of the corners.
+   */
+  double coarseSdf(const Observation& obs, const size_t level) const
+  {
+    const int x0 = static_cast<int>(std::floor(min_x));
+    const int y0 = static_cast<int>(std::floor(min_y));
+    const int x1 = static_cast<int>(std::ceil(max_x)) + 1;
+    const int y1 = static_cast<int>(std::ceil(max_y)) + 1;
+    int occupied = obs.occupiedUpperBound(level, x0, y0, x1, y1);
 
-    float sub_size = std::max(width, height);
+    float area = width * height;
+    float margin = 2 * (width + height) + 4;
 
-    int start_x = std::max(0, static_cast<int>(std::floor(x - sub_size)));
-    int start_y = std::max(0, static_cast<int>(std::floor(y - sub_size)));
-    int end_x = std::min(static_cast<int>(obs.width), static_cast<int>(std::ceil(x + sub_size)));
-    int end_y = std::min(static_cast<int>(obs.height), static_cast<int>(std::ceil(y + sub_size)));
+    return coarseBound(occupied, area, margin, outsideArea(obs, x0, y0, x1, y1), max_area);
+  }
+
+  /**
+   * Mean distance from points along the edges to the closest observed edge.
+   */
+  double chamfer(const Observation& obs) const
+  {
+    double sum = 0;
+    int num_pts = 0;
 
-    for (int i = start_x; i < end_x; ++i)
+    for (size_t i = 0; i < 4; ++i)
     {
-      for (int j = start_y; j < end_y; ++j)
+      const std::vector<float>& a = corner_pts[i];
+      const std::vector<float>& b = corner_pts[(i + 1) % 4];
+      float len = sqrt((b[0] - a[0]) * (b[0] - a[0]) + (b[1] - a[1]) * (b[1] - a[1]));
+      int steps = std::max(1, static_cast<int>(std::ceil(len / CHAMFER_STEP)));
+
+      // Each edge contributes its first corner, but not its last.
+      for (int k = 0; k < steps; ++k)
       {
-        bool point_inside = pointInside(i, j);
-        if (point_inside)
-        {
-          if (obs.isOccupied(i, j))
-          {
-            sdf += PER_PIX;
-          }
-          else
-          {
-            sdf -= PER_PIX;
-          }
-        }
+        float t = static_cast<float>(k) / steps;
+        float d = obs.getDistance(std::round(a[0] + t * (b[0] - a[0])), std::round(a[1] + t * (b[1] - a[1])));
+        sum += std::min(d, static_cast<float>(CHAMFER_MAX_DIST));
+        num_pts++;
       }
-
     }
 
-    sdf = sdf / (PER_PIX * max_area);
-
-    return std::max(EPS, sdf);
+    return sum / num_pts;
   }
 
+  /**
+   * Set the corners, in order around the rectangle, and precompute the
+   * bounding box and edges used to rasterize it.
+   */
   void setPoints(const std::vector<std::vector<float> >& pts)
   {
     corner_pts = pts;
-  }
+    if (corner_pts.size() != 4) return;
 
-  bool pointInside(const float pt_x, const float pt_y) const
-  {
-    // Algorithm to check if a point is inside a polygon.
-    //   (https://en.wikipedia.org/wiki/Point_in_polygon)
-    int num_intersect = 0;
-
-    std::vector<float> origin({0, 0});
-    std::vector<float> pt({pt_x, pt_y});
+    float cx = 0, cy = 0;
+    min_x = max_x = corner_pts[0][0];
+    min_y = max_y = corner_pts[0][1];
+    for (auto& p : corner_pts)
+    {
+      min_x = std::min(min_x, p[0]);
+      max_x = std::max(max_x, p[0]);
+      min_y = std::min(min_y, p[1]);
+      max_y = std::max(max_y, p[1]);
+      cx += p[0] / 4;
+      cy += p[1] / 4;
+    }
 
+    // The corners can go either way around, so point each normal away from
+    // the center.
     for (size_t i = 0; i < 4; ++i)
     {
-      if (intersect(origin, pt, corner_pts[i], corner_pts[(i + 1) % 4])) num_intersect++;
+      const std::vector<float>& a = corner_pts[i];
+      const std::vector<float>& b = corner_pts[(i + 1) % 4];
+      HalfPlane& e = edges[i];
+      e.nx = b[1] - a[1];
+      e.ny = a[0] - b[0];
+      e.offset = e.nx * a[0] + e.ny * a[1];
+
+      if (e.nx * cx + e.ny * cy > e.offset)
+      {
+        e.nx = -e.nx;
+        e.ny = -e.ny;
+        e.offset = -e.offset;
+      }
     }
-
-    return num_intersect % 2 != 0;
   }
 
-private:
-  bool ccw(const std::vector<float>& A,
-           const std::vector<float>& B,
-           const std::vector<float>& C) const
+  bool pointInside(const float pt_x, const float pt_y) const
   {
-    return (C[1]-A[1])*(B[0]-A[0]) >= (B[1]-A[1])*(C[0]-A[0]);
-  }
+    if (corner_pts.size() != 4) return false;
 
-  bool intersect(const std::vector<float>& A,
-                 const std::vector<float>& B,
-                 const std::vector<float>& C,
-                 const std::vector<float>& D) const
-  {
-    // Algorithm to check intersection of two line segments.
-    //   (https://bryceboe.com/2006/10/23/line-segment-intersection-algorithm/)
-    return ccw(A,C,D) != ccw(B,C,D) && ccw(A,B,C) != ccw(A,B,D);
+    for (auto& e : edges)
+    {
+      if (e.nx * pt_x + e.ny * pt_y > e.offset) return false;
+    }
+
+    return true;
   }
 };
 
@@ -281,55 +436,76 @@ public:
 
     for (size_t i = 0; i < num_joints; ++i)
     {
-      Eigen::Transform<float,2,Eigen::Affine> rect_tf;
-      Eigen::Translation<float, 2> tw(x, y);
-      Eigen::Translation<float, 2> rect_center_tf(w / 2 + w, 0);
-      float theta;
+      links.push_back(makeLink(i, w, h));
+    }
+  }
 
-      if (i < num_joints / 2)
-      {
-        // This is the first layer of joints, connected to the root.
-        theta = joints[i];
-        Eigen::Translation<float, 2> t1(w / 2 + w, 0);
-        Eigen::Rotation2D<float> rot1(theta);
-        rect_tf = tw * rot1;
-      }
-      else
-      {
-        // This is the second layer of joints, connected to the first layer.
-        float parent_joint = joints[i - num_joints / 2];
-        theta = normalize_angle(joints[i] + parent_joint);
-        Eigen::Translation<float, 2> t1(w + w, 0);
-        Eigen::Rotation2D<float> rot1(parent_joint);
-        Eigen::Rotation2D<float> rot2(joints[i]);
-        rect_tf = tw * rot1 * t1 * rot2;
-      }
+  /**
+   * Change one joint angle, updating only the links it moves: the link
+   * itself and, for the first layer, its child.
+   */
+  void setJoint(const size_t i, const float angle)
+  {
+    float min = 4.0;
+    joints[i] = angle;
+    links[i] = makeLink(i, std::max(w, min), std::max(h, min));
 
-      Eigen::Vector2f pt(0, 0);
-      auto new_pt = rect_tf * rect_center_tf * pt;
+    if (i < num_joints / 2)
+    {
+      links[i + num_joints / 2] = makeLink(i + num_joints / 2, std::max(w, min), std::max(h, min));
+    }
+  }
 
-      Rectangle r(new_pt[0], new_pt[1], theta, w, h);
+  Rectangle makeLink(const size_t i, const float w, const float h) const
+  {
+    Eigen::Transform<float,2,Eigen::Affine> rect_tf;
+    Eigen::Translation<float, 2> tw(x, y);
+    Eigen::Translation<float, 2> rect_center_tf(w / 2 + w, 0);
+    float theta;
 
-      // Get four corners.
-      Eigen::Translation<float, 2> top_left_tf(w, r.height / 2);
-      Eigen::Translation<float, 2> bottom_left_tf(w, -r.height / 2);
-      Eigen::Translation<float, 2> top_right_tf(w + w, r.height / 2);
-      Eigen::Translation<float, 2> bottom_right_tf(w + w, -r.height / 2);
+    if (i < num_joints / 2)
+    {
+      // This is the first layer of joints, connected to the root.
+      theta = joints[i];
+      Eigen::Translation<float, 2> t1(w / 2 + w, 0);
+      Eigen::Rotation2D<float> rot1(theta);
+      rect_tf = tw * rot1;
+    }
+    else
+    {
+      // This is the second layer of joints, connected to the first layer.
+      float parent_joint = joints[i - num_joints / 2];
+      theta = normalize_angle(joints[i] + parent_joint);
+      Eigen::Translation<float, 2> t1(w + w, 0);
+      Eigen::Rotation2D<float> rot1(parent_joint);
+      Eigen::Rotation2D<float> rot2(joints[i]);
+      rect_tf = tw * rot1 * t1 * rot2;
+    }
 
-      auto top_left = rect_tf * top_left_tf * pt;
-      auto bottom_left = rect_tf * bottom_left_tf * pt;
-      auto top_right = rect_tf * top_right_tf * pt;
-      auto bottom_right = rect_tf * bottom_right_tf * pt;
+    Eigen::Vector2f pt(0, 0);
+    auto new_pt = rect_tf * rect_center_tf * pt;
 
-      std::vector<std::vector<float> > rect_pts({{top_left[0], top_left[1]},
-                                                 {top_right[0], top_right[1]},
-                                                 {bottom_right[0], bottom_right[1]},
-                                                 {bottom_left[0], bottom_left[1]}});
+    Rectangle r(new_pt[0], new_pt[1], theta, w, h);
 
-      r.setPoints(rect_pts);
+    // Get four corners.
+    Eigen::Translation<float, 2> top_left_tf(w, r.height / 2);
+    Eigen::Translation<float, 2> bottom_left_tf(w, -r.height / 2);
+    Eigen::Translation<float, 2> top_right_tf(w + w, r.height / 2);
+    Eigen::Translation<float, 2> bottom_right_tf(w + w, -r.height / 2);
 
-      links.push_back(r);
-    }
+    auto top_left = rect_tf * top_left_tf * pt;
+    auto bottom_left = rect_tf * bottom_left_tf * pt;
+    auto top_right = rect_tf * top_right_tf * pt;
+    auto bottom_right = rect_tf * bottom_right_tf * pt;
+
+    std::vector<std::vector<float> > rect_pts({{top_left[0], top_left[1]},
+                                               {top_right[0], top_right[1]},
+                                               {bottom_right[0], bottom_right[1]},
+                                               {bottom_left[0], bottom_left[1]}});
+
+    r.setPoints(rect_pts);
+
+    return r;
   }
 
   ParticleState toPartStates() const
@@ -372,41 +548,115 @@ public:
     return true;
   }
 
+  /**
+   * Scanline fill of the spider, done once and shared by the scoring
+   * functions.
+   * @return The spans of each shape, the root first and then the links.
+   */
+  std::vector<SpanList> rasterize() const
+  {
+    std::vector<SpanList> shapes(links.size() + 1);
+    root.spans(shapes[0]);
+    for (size_t i = 0; i < links.size(); ++i) links[i].spans(shapes[i + 1]);
+
+    return shapes;
+  }
+
   double iou(const Observation& obs) const
   {
     // Intersection over union in a small square.
     int sub_size = w * 4;  // Half the size of the sub observation.
-    float intersect = 0;
-    float uni = 0;
 
     int start_x = std::max(0, static_cast<int>(std::floor(x - sub_size)));
     int start_y = std::max(0, static_cast<int>(std::floor(y - sub_size)));
     int end_x = std::min(static_cast<int>(obs.width), static_cast<int>(std::ceil(x + sub_size)));
     int end_y = std::min(static_cast<int>(obs.height), static_cast<int>(std::ceil(y + sub_size)));
+    if (end_x <= start_x || end_y <= start_y) return 0;
 
-    for (size_t i = start_x; i < end_x; ++i)
+    // The mask words line up with the observation words, so both sets are
+    // counted 64 pixels at a time.
+    BitMask mask;
+    mask.reset(start_x, start_y, end_x - start_x, end_y - start_y);
+    for (auto& shape : rasterize()) rasterizeSpans(shape, mask);
+
+    const BitMask& occupied = obs.occupancyMask();
+    int intersect = 0;
+    int uni = 0;
+
+    for (int j = start_y; j < end_y; ++j)
     {
-      for (size_t j = start_y; j < end_y; ++j)
+      for (int k = 0; k < mask.wordsPerRow(); ++k)
       {
-        bool point_inside = pointInside(i, j);
-        if (point_inside && obs.getPixel(i, j) == 1) intersect++;
-        if (point_inside || obs.getPixel(i, j) == 1) uni++;
+        int word_col = mask.col0() + 64 * k;
+        uint64_t in_window = columnBits(word_col, start_x, end_x);
+        uint64_t m = mask.word(word_col, j) & in_window;
+        uint64_t o = occupied.word(word_col, j) & in_window;
+
+        intersect += popcount64(m & o);
+        uni += popcount64(m | o);
       }
     }
 
-    return intersect / uni;
+    if (uni == 0) return 0;
+    return static_cast<double>(intersect) / uni;
   }
 
   double sdf(const Observation& obs) const
   {
-    double sdf = log(root.sdf(obs));
+    // The shapes are scored one at a time through a single span buffer.
+    SpanList spans;
+    LogSum sdf;
+    root.spans(spans);
+    sdf.add(spanSdf(obs, spans, root.max_area));
+
+    for (auto& l : links)
+    {
+      spans.clear();
+      l.spans(spans);
+      sdf.add(spanSdf(obs, spans, l.max_area));
+    }
+
+    return sdf.value();
+  }
+
+  /**
+   * Chamfer log likelihood. Each shape's boundary should lie on the edges of
+   * the observation, with Gaussian noise on the mean distance.
+   */
+  double chamfer(const Observation& obs) const
+  {
+    double d = root.chamfer(obs) / CHAMFER_SIGMA;
+    double log_likelihood = -0.5 * d * d;
 
     for (auto& l : links)
     {
-      sdf += log(l.sdf(obs));
+      d = l.chamfer(obs) / CHAMFER_SIGMA;
+      log_likelihood -= 0.5 * d * d;
+    }
+
+    return log_likelihood;
+  }
+
+  /**
+   * Log of the fraction of occupied pixels inside each shape.
+   */
+  double averageLikelihood(const Observation& obs) const
+  {
+    SpanList spans;
+    LogSum log_likelihood;
+
+    for (size_t i = 0; i <= links.size(); ++i)
+    {
+      spans.clear();
+      if (i == 0) root.spans(spans);
+      else        links[i - 1].spans(spans);
+
+      int num_pts;
+      float sum = spanSum(obs, spans, num_pts);
+      log_likelihood.add(std::max(static_cast<float>(EPS), sum / std::max(1, num_pts)));
     }
 
-    return sdf;  // std::max(0.0, sdf);
+    return log_likelihood.value();
   }
 
   double jointUnaryLikelihood(const Observation& obs) const
@@ -414,6 +664,23 @@ public:
     return sdf(obs);
   }
 
+  /**
+   * Upper bound on the joint unary likelihood, computed at a coarse level of
+   * the observation pyramid. Particles in empty space get their exact score.
+   */
+  double coarseLikelihood(const Observation& obs, const size_t level) const
+  {
+    LogSum sdf;
+    sdf.add(root.coarseSdf(obs, level));
+
+    for (auto& l : links)
+    {
+      sdf.add(l.coarseSdf(obs, level));
+    }
+
+    return sdf.value();
+  }
+
   void print() const
   {
     std::cout << "x: " << x << ", y: " << y;
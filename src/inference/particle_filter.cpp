@@ -7,53 +7,326 @@ namespace BPSandbox
 ParticleFilter::ParticleFilter() :
   num_joints_(8),
   num_particles_(50),
-  update_count_(0)
+  update_count_(0),
+  likelihood_(LikelihoodType::SDF),
+  score_ns_(0),
+  score_count_(0),
+  coarse_to_fine_(true),
+  coarse_level_(2),
+  coarse_cutoff_(10),
+  proposal_rate_(0.1),
+  jitter_pix_(2),
+  jitter_angle_(0.1),
+  jitter_param_(2),
+  anneal_(false),
+  anneal_beta0_(0.1),
+  anneal_beta_rate_(1.5),
+  anneal_jitter_decay_(0.8),
+  anneal_min_jitter_(0.1),
+  resample_move_(false),
+  num_moves_(8),
+  move_angle_(0.2),
+  move_acceptance_(0),
+  factored_(false),
+  leg_candidates_(4),
+  adaptive_(false),
+  min_particles_(10),
+  max_particles_(1000),
+  kld_epsilon_(0.05),
+  kld_bin_pix_(5),
+  ess_threshold_(0.5),
+  ess_(0),
+  resampled_(false),
+  detect_convergence_(true),
+  converged_(false),
+  convergence_pix_(0.5),
+  convergence_w_(0.1),
+  convergence_patience_(5),
+  stable_count_(0),
+  last_x_(0),
+  last_y_(0),
+  last_best_w_(0),
+  checkpoint_every_(0),
+  gen_(std::random_device{}()),
+  particles_(std::make_shared<const spider::SpiderList>()),
+  weights_(std::make_shared<const std::vector<double> >())
 {
 }
 
-spider::ParticleStateList ParticleFilter::init(const int num_particles, const bool use_obs)
+void ParticleFilter::setResampleThreshold(const double ess_fraction)
+{
+  ess_threshold_ = ess_fraction;
+}
+
+void ParticleFilter::setConvergence(const bool enabled, const float tolerance_pix,
+                                    const double tolerance_w, const size_t patience)
+{
+  detect_convergence_ = enabled;
+  convergence_pix_ = tolerance_pix;
+  convergence_w_ = tolerance_w;
+  convergence_patience_ = std::max<size_t>(1, patience);
+}
+
+void ParticleFilter::setAdaptive(const bool enabled, const size_t min_particles, const size_t max_particles,
+                                 const double epsilon, const float bin_pix)
+{
+  adaptive_ = enabled;
+  min_particles_ = std::max<size_t>(1, min_particles);
+  max_particles_ = std::max(min_particles_, max_particles);
+  kld_epsilon_ = epsilon;
+  kld_bin_pix_ = bin_pix;
+}
+
+void ParticleFilter::setJitter(const float pix, const float angle, const float param)
+{
+  jitter_pix_ = pix;
+  jitter_angle_ = angle;
+  jitter_param_ = param;
+}
+
+void ParticleFilter::setAnnealing(const bool enabled, const double beta0, const double beta_rate,
+                                  const double jitter_decay, const double min_jitter)
+{
+  anneal_ = enabled;
+  anneal_beta0_ = std::min(1.0, std::max(1e-6, beta0));
+  anneal_beta_rate_ = std::max(1.0, beta_rate);
+  anneal_jitter_decay_ = std::min(1.0, std::max(0.0, jitter_decay));
+  anneal_min_jitter_ = std::max(0.0, min_jitter);
+}
+
+double ParticleFilter::temperature() const
+{
+  if (!anneal_) return 1;
+  return std::min(1.0, anneal_beta0_ * std::pow(anneal_beta_rate_, update_count_));
+}
+
+double ParticleFilter::jitterScale() const
+{
+  if (!anneal_) return 1;
+  return std::max(anneal_min_jitter_, std::pow(anneal_jitter_decay_, update_count_));
+}
+
+std::vector<double> ParticleFilter::temper(const std::vector<double>& weights) const
+{
+  const double beta = temperature();
+  if (beta >= 1) return weights;
+
+  std::vector<double> tempered(weights);
+  for (auto& w : tempered) w *= beta;
+  return tempered;
+}
+
+void ParticleFilter::setResampleMove(const bool enabled, const size_t num_moves, const float angle_std)
+{
+  resample_move_ = enabled;
+  num_moves_ = num_moves;
+  move_angle_ = std::max(0.f, angle_std);
+}
+
+void ParticleFilter::setFactored(const bool enabled, const size_t num_candidates)
+{
+  factored_ = enabled;
+  leg_candidates_ = std::max<size_t>(1, num_candidates);
+}
+
+void ParticleFilter::setProposalRate(const double rate)
+{
+  proposal_rate_ = std::min(1.0, std::max(0.0, rate));
+}
+
+void ParticleFilter::setObservations(const std::vector<Observation>& views)
+{
+  if (views.size() < 1) return;
+
+  obs_ = views[0];
+  extra_views_.assign(views.begin() + 1, views.end());
+}
+
+void ParticleFilter::setLikelihood(const LikelihoodType type)
+{
+  likelihood_ = type;
+}
+
+void ParticleFilter::setCoarseToFine(const bool enabled, const size_t level, const double cutoff)
+{
+  coarse_to_fine_ = enabled;
+  coarse_level_ = level;
+  coarse_cutoff_ = cutoff;
+}
+
+const spider::SpiderList& ParticleFilter::init(const int num_particles, bool use_obs)
 {
   num_particles_ = num_particles;
   update_count_ = 0;
+  converged_ = false;
+  stable_count_ = 0;
+  resampled_ = false;
+  score_ns_ = 0;
+  score_count_ = 0;
 
-  particles_.clear();
-  weights_.clear();
+  targets_.clear();
 
-  auto obs_circ = obs_.getCircles();
+  const GridIndex& circles = obs_.circleIndex();
+  if (circles.size() < 1) use_obs = false;
 
-  std::random_device rd{};
-  std::mt19937 gen{rd()};
   std::uniform_real_distribution<float> pix_dist(0, obs_.width - 1);
-  std::uniform_int_distribution<int> idx_dist(0, obs_circ.size() - 1);
+  std::uniform_int_distribution<int> idx_dist(0, std::max(0, static_cast<int>(circles.size()) - 1));
 
+  spider::SpiderList particles;
   for (size_t i = 0; i < num_particles; ++i)
   {
-    float x, y, r = 10;
     if (use_obs)
     {
-      auto circ_sample = obs_circ[idx_dist(gen)];
-      x = circ_sample[1];
-      y = circ_sample[0];
-      r = circ_sample[2];
+      particles.push_back(proposeParticle(idx_dist(gen_), gen_));
     }
     else
     {
-      x = pix_dist(gen);
-      y = pix_dist(gen);
+      particles.push_back(randomParticle(pix_dist(gen_), pix_dist(gen_), 10));
     }
+  }
+
+  std::vector<double> weights = reweight(particles);
+  setParticles(std::move(particles), std::move(weights));
+  publish();
+
+  return *particles_;
+}
 
-    particles_.push_back(randomParticle(x, y, r));
+const spider::SpiderList& ParticleFilter::initTargets(const int num_particles)
+{
+  num_particles_ = num_particles;
+  update_count_ = 0;
+  converged_ = false;
+  stable_count_ = 0;
+  resampled_ = false;
+
+  targets_.clear();
+
+  // Every observed circle in the image could be the root of a spider.
+  const GridIndex& circles = obs_.circleIndex();
+  spider::SpiderList particles;
+  std::vector<double> weights;
+  for (size_t c = 0; c < circles.size(); ++c)
+  {
+    if (circles.x(c) < 0 || circles.x(c) >= obs_.width ||
+        circles.y(c) < 0 || circles.y(c) >= obs_.height) continue;
+
+    Target target;
+    target.gen.seed(gen_());
+    for (size_t i = 0; i < num_particles; ++i)
+    {
+      target.particles.push_back(proposeParticle(c, gen_));
+    }
+    target.weights = reweight(target.particles);
+
+    particles.insert(particles.end(), target.particles.begin(), target.particles.end());
+    weights.insert(weights.end(), target.weights.begin(), target.weights.end());
+    targets_.push_back(target);
+  }
+
+  setParticles(std::move(particles), std::move(weights));
+  publish();
+
+  return *particles_;
+}
+
+const spider::SpiderList& ParticleFilter::updateTargets()
+{
+  // The targets don't share any state, so each one is updated on its own
+  // thread.
+  std::vector<std::future<void> > jobs;
+  for (auto& target : targets_)
+  {
+    jobs.push_back(std::async(std::launch::async, &ParticleFilter::updateTarget, this, std::ref(target)));
   }
 
-  weights_ = reweight(particles_, obs_);
+  spider::SpiderList particles;
+  std::vector<double> weights;
+  for (size_t i = 0; i < targets_.size(); ++i)
+  {
+    jobs[i].get();
+    particles.insert(particles.end(), targets_[i].particles.begin(), targets_[i].particles.end());
+    weights.insert(weights.end(), targets_[i].weights.begin(), targets_[i].weights.end());
+  }
+
+  setParticles(std::move(particles), std::move(weights));
+  update_count_++;
+  publish();
 
-  return spider::particlesToMap(particles_);
+  return *particles_;
+}
+
+void ParticleFilter::updateTarget(Target& target) const
+{
+  if (target.particles.size() < 1) return;
+
+  // Add noise to particles, but keep the best one.
+  size_t best = std::max_element(target.weights.begin(), target.weights.end()) - target.weights.begin();
+  auto best_particle = target.particles[best];
+  const double scale = jitterScale();
+  target.particles = jitterParticles(target.particles, jitter_pix_ * scale, jitter_angle_ * scale,
+                                     jitter_param_ * scale, target.gen);
+  target.particles.push_back(best_particle);
+
+  target.weights = reweight(target.particles);
+
+  std::vector<double> normalized_weights = normalizeVector(temper(target.weights), true);
+  std::vector<size_t> keep = lowVarianceSample(num_particles_, normalized_weights, target.gen);
+
+  spider::SpiderList new_particles;
+  std::vector<double> new_weights;
+  for (auto& idx : keep)
+  {
+    new_particles.push_back(target.particles[idx]);
+    new_weights.push_back(target.weights[idx]);
+  }
+
+  target.particles = new_particles;
+  target.weights = new_weights;
+}
+
+spider::SpiderList ParticleFilter::estimateAll(const double min_likelihood)
+{
+  if (targets_.empty())
+  {
+    // Single target mode has one estimate.
+    return estimate();
+  }
+
+  // Keep the likely targets, best first, dropping any whose root lies
+  // inside the root of a better one.
+  std::vector<std::pair<double, size_t> > found;
+  for (size_t i = 0; i < targets_.size(); ++i)
+  {
+    auto& w = targets_[i].weights;
+    if (w.size() < 1) continue;
+
+    double best = *std::max_element(w.begin(), w.end());
+    if (best >= min_likelihood) found.push_back({best, i});
+  }
+  std::sort(found.begin(), found.end(), std::greater<std::pair<double, size_t> >());
+
+  spider::SpiderList est;
+  for (auto& f : found)
+  {
+    auto& target = targets_[f.second];
+    size_t best = std::max_element(target.weights.begin(), target.weights.end()) - target.weights.begin();
+    const spider::SpiderParticle& p = target.particles[best];
+
+    bool duplicate = false;
+    for (auto& e : est)
+    {
+      if (e.root.pointInside(p.x, p.y)) duplicate = true;
+    }
+    if (!duplicate) est.push_back(p);
+  }
+
+  return est;
 }
 
 spider::SpiderParticle ParticleFilter::randomParticle(const float x, const float y, const float r)
 {
-  std::random_device rd{};
-  std::mt19937 gen{rd()};
+  std::mt19937& gen = gen_;
   std::uniform_real_distribution<float> pix_dist(0, 10);
   std::normal_distribution<float> h_dist{8, 2};
   std::normal_distribution<float> w_dist{27, 5};
@@ -76,38 +349,325 @@ spider::SpiderParticle ParticleFilter::randomParticle(const float x, const float
   return sp;
 }
 
-spider::ParticleStateList ParticleFilter::update()
+spider::SpiderParticle ParticleFilter::proposeParticle(const size_t circle_idx, std::mt19937& gen)
 {
-  // Add noise to particles, but keep the best one.
+  // Place the root on an observed circle, then point each leg at the
+  // observed rectangles within reach. Legs with no rectangle nearby are
+  // sampled around their nominal angle, like randomParticle().
+  const GridIndex& circles = obs_.circleIndex();
+  const GridIndex& rects = obs_.rectangleIndex();
+  const float x = circles.x(circle_idx);
+  const float y = circles.y(circle_idx);
+  const float r = obs_.getCircles()[circle_idx][2];
+  const float w = 27, h = 8;
+
+  std::normal_distribution<float> theta_dist{0, PI / 8};
+  std::normal_distribution<float> pix_dist{0, 1};
+
+  // Link centers are 1.5 link lengths from the root for the first layer, and
+  // 3.5 link lengths away for the second layer.
+  std::vector<size_t> inner, outer;
+  for (auto& idx : rects.query(x, y, 4.5 * w))
+  {
+    float dx = rects.x(idx) - x, dy = rects.y(idx) - y;
+    float dist = sqrt(dx * dx + dy * dy);
+    if (dist < 2.5 * w) inner.push_back(idx);
+    else                outer.push_back(idx);
+  }
+
+  std::vector<float> joints(num_joints_);
+  for (size_t i = 0; i < num_joints_ / 2; ++i)
+  {
+    float nominal = i * PI / 2;
+    float best_diff = PI / 4;
+    joints[i] = normalize_angle(nominal + theta_dist(gen));
+
+    for (auto& idx : inner)
+    {
+      float angle = atan2(rects.y(idx) - y, rects.x(idx) - x);
+      float diff = std::abs(remainder(angle - nominal, 2 * PI));
+      if (diff < best_diff)
+      {
+        best_diff = diff;
+        joints[i] = normalize_angle(angle);
+      }
+    }
+  }
+
+  for (size_t i = num_joints_ / 2; i < num_joints_; ++i)
+  {
+    float parent = joints[i - num_joints_ / 2];
+    float elbow_x = x + 2 * w * cos(parent), elbow_y = y + 2 * w * sin(parent);
+    float best_diff = PI / 4;
+    joints[i] = theta_dist(gen);
+
+    for (auto& idx : outer)
+    {
+      float angle = atan2(rects.y(idx) - elbow_y, rects.x(idx) - elbow_x);
+      float diff = remainder(angle - parent, 2 * PI);
+      if (std::abs(diff) < best_diff)
+      {
+        best_diff = std::abs(diff);
+        joints[i] = diff;
+      }
+    }
+  }
+
+  return spider::SpiderParticle(x + pix_dist(gen), y + pix_dist(gen), r, w, h, joints);
+}
+
+const spider::SpiderList& ParticleFilter::update()
+{
+  // Nothing left to do once the estimate has settled.
+  if (converged_) return *particles_;
+
+  if (!targets_.empty()) return updateTargets();
+
+  // Add noise to particles, but keep the best one. Factored proposals leave
+  // the joints to sampleLegs().
   auto best = particleEstimate();
-  particles_ = jitterParticles(particles_, 2, 0.1, 2);
-  particles_.push_back(best);
+  const double scale = jitterScale();
+  const bool factored = factored_ && likelihood_ != LikelihoodType::IOU;
+  // The published particles are never changed, so the step works on a new
+  // set which replaces them at the end.
+  spider::SpiderList particles = jitterParticles(*particles_, jitter_pix_ * scale,
+                                                 factored ? 0 : jitter_angle_ * scale, jitter_param_ * scale, gen_);
 
-  weights_ = reweight(particles_, obs_);
-  particles_ = resample(particles_, weights_);
+  // Between resamples each particle keeps its weight and the new likelihood
+  // is added to it. A resample leaves the particles equally weighted.
+  std::vector<double> prior(particles.size(), 0);
+  if (!resampled_ && weights_->size() == particles.size()) prior = *weights_;
+  double max_prior = prior.empty() ? 0 : *std::max_element(prior.begin(), prior.end());
 
+  // Replace some particles with proposals from the observation. They start
+  // from the mean weight of the particles they replace.
+  const size_t num_circles = obs_.circleIndex().size();
+  const size_t num_proposals = std::round(proposal_rate_ * particles.size());
+  if (num_circles > 0 && num_proposals > 0)
+  {
+    double total = 0;
+    for (auto& w : prior) total += std::exp(w - max_prior);
+    const double mean_prior = max_prior + std::log(total / prior.size());
+
+    std::uniform_int_distribution<int> idx_dist(0, num_circles - 1);
+    std::uniform_int_distribution<int> particle_dist(0, particles.size() - 1);
+
+    for (size_t i = 0; i < num_proposals; ++i)
+    {
+      size_t idx = particle_dist(gen_);
+      particles[idx] = proposeParticle(idx_dist(gen_), gen_);
+      prior[idx] = mean_prior;
+    }
+  }
+
+  // The estimate is the particle with the largest weight.
+  particles.push_back(best);
+  prior.push_back(max_prior);
+
+  std::vector<double> weights;
+  if (factored) weights = factoredReweight(particles, jitter_angle_ * scale, particles.size() - 1);
+  else          weights = reweight(particles);
+
+  const double best_likelihood = *std::max_element(weights.begin(), weights.end());
+  for (size_t i = 0; i < weights.size(); ++i) weights[i] += prior[i];
+
+  ess_ = BPSandbox::effectiveSampleSize(normalizeVector(temper(weights), true));
+  resampled_ = ess_ < ess_threshold_ * weights.size();
+  if (resampled_)
+  {
+    particles = resample(particles, weights);
+    if (resample_move_) resampleMove(particles, weights);
+  }
+  else
+  {
+    // Keep the particles, but drop the worst ones to keep the set size.
+    while (particles.size() > num_particles_)
+    {
+      size_t worst = std::min_element(weights.begin(), weights.end()) - weights.begin();
+      particles.erase(particles.begin() + worst);
+      weights.erase(weights.begin() + worst);
+    }
+  }
+
+  setParticles(std::move(particles), std::move(weights));
   update_count_++;
+  checkConvergence(best_likelihood);
+  publish();
 
-  return spider::particlesToMap(particles_);
+  if (checkpoint_every_ > 0 && update_count_ % checkpoint_every_ == 0)
+  {
+    saveSnapshotAsync(checkpoint_path_);
+  }
+
+  return *particles_;
 }
 
-std::vector<double> ParticleFilter::reweight(const spider::SpiderList& particles, const Observation& obs)
+void ParticleFilter::checkConvergence(const double best_w)
 {
-  std::vector<double> weights;
-  for (auto& p: particles)
+  if (!detect_convergence_ || weights_->size() < 1) return;
+
+  auto est = particleEstimate();
+
+  if (update_count_ > 1)
+  {
+    float dx = est.x - last_x_, dy = est.y - last_y_;
+    bool still = dx * dx + dy * dy < convergence_pix_ * convergence_pix_;
+    bool settled = best_w - last_best_w_ < convergence_w_;
+
+    // An annealed filter only settles once the likelihood is untempered.
+    if (still && settled && temperature() >= 1) stable_count_++;
+    else                  stable_count_ = 0;
+  }
+
+  last_x_ = est.x;
+  last_y_ = est.y;
+  last_best_w_ = best_w;
+
+  if (stable_count_ >= convergence_patience_) converged_ = true;
+}
+
+std::vector<double> ParticleFilter::reweight(const spider::SpiderList& particles) const
+{
+  auto start = std::chrono::steady_clock::now();
+
+  // Each extra view scores the whole batch on its own thread, so every image
+  // stays in the cache of one core while the primary view is scored here.
+  std::vector<std::future<std::vector<double> > > views;
+  for (auto& view : extra_views_)
+  {
+    views.push_back(std::async(std::launch::async, [this, &particles, &view]() {
+      return reweightView(particles, view);
+    }));
+  }
+
+  std::vector<double> weights = reweightView(particles, obs_);
+  for (auto& f : views)
+  {
+    std::vector<double> view_weights = f.get();
+    for (size_t i = 0; i < weights.size(); ++i) weights[i] += view_weights[i];
+  }
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  score_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  score_count_ += particles.size();
+
+  return weights;
+}
+
+std::vector<double> ParticleFilter::reweightView(const spider::SpiderList& particles, const Observation& obs) const
+{
+  if (likelihood_ == LikelihoodType::SDF && coarse_to_fine_) return coarseToFine(particles, obs);
+
+  return scoreParticles(likelihood_, particles, obs);
+}
+
+std::vector<double> ParticleFilter::coarseToFine(const spider::SpiderList& particles, const Observation& obs) const
+{
+  // The coarse score bounds the full score from above. Visit the particles
+  // from the most promising bound down, and stop refining once the bound
+  // falls further than the cutoff below the best full score found.
+  std::vector<std::pair<double, size_t> > bounds;
+  for (size_t i = 0; i < particles.size(); ++i)
   {
-    double w = p.jointUnaryLikelihood(obs);
-    weights.push_back(w);
+    bounds.push_back({particles[i].coarseLikelihood(obs, coarse_level_), i});
+  }
+  std::sort(bounds.begin(), bounds.end(), std::greater<std::pair<double, size_t> >());
+
+  std::vector<double> weights(particles.size());
+  double best = -std::numeric_limits<double>::infinity();
+  double worst = std::numeric_limits<double>::infinity();
+  size_t num_scored = 0;
+  for (; num_scored < bounds.size(); ++num_scored)
+  {
+    const std::pair<double, size_t>& b = bounds[num_scored];
+    if (b.first < best - coarse_cutoff_) break;
+
+    weights[b.second] = SdfLikelihood::score(particles[b.second], obs);
+    best = std::max(best, weights[b.second]);
+    worst = std::min(worst, weights[b.second]);
+  }
+
+  // The bounds only grow smaller, so the rest are pruned. A bound is not a
+  // likelihood and could outweigh the scored particles, so a pruned particle
+  // gets no more than the worst full score.
+  for (size_t i = num_scored; i < bounds.size(); ++i)
+  {
+    weights[bounds[i].second] = std::min(bounds[i].first, worst);
   }
 
   return weights;
 }
 
+double ParticleFilter::likelihoodCost() const
+{
+  if (score_count_ == 0) return 0;
+  return score_ns_ / 1000.0 / score_count_;
+}
+
+double ParticleFilter::poseError()
+{
+  spider::SpiderList gt = groundTruth(obs_);
+  if (gt.size() < 1 || particles_->size() < 1) return std::numeric_limits<double>::quiet_NaN();
+
+  return BPSandbox::poseError(particleEstimate(), gt[0]);
+}
+
+std::vector<LikelihoodReport> ParticleFilter::profileLikelihoods() const
+{
+  std::vector<LikelihoodReport> reports;
+  spider::SpiderList gt = groundTruth(obs_);
+
+  for (auto& type : ALL_LIKELIHOODS)
+  {
+    LikelihoodReport report;
+    report.type = type;
+    report.cost_us = 0;
+    report.pose_error = std::numeric_limits<double>::quiet_NaN();
+    report.gt_margin = std::numeric_limits<double>::quiet_NaN();
+
+    if (particles_->size() > 0)
+    {
+      auto start = std::chrono::steady_clock::now();
+      std::vector<double> weights = scoreParticles(type, *particles_, obs_);
+      std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+      report.cost_us = elapsed.count() / particles_->size();
+
+      size_t best = std::max_element(weights.begin(), weights.end()) - weights.begin();
+      if (gt.size() > 0)
+      {
+        report.pose_error = BPSandbox::poseError((*particles_)[best], gt[0]);
+        report.gt_margin = scoreParticles(type, gt, obs_)[0] - weights[best];
+      }
+    }
+
+    reports.push_back(report);
+  }
+
+  return reports;
+}
+
 spider::SpiderList ParticleFilter::resample(const spider::SpiderList& particles, std::vector<double>& weights)
 {
-  std::vector<double> normalized_weights = normalizeVector(weights, true);
-  // std::vector<size_t> keep = importanceSample(num_particles_, normalized_weights);
-  std::vector<size_t> keep = lowVarianceSample(num_particles_, normalized_weights);
+  std::vector<double> normalized_weights = normalizeVector(temper(weights), true);
+  // std::vector<size_t> keep = importanceSample(num_particles_, normalized_weights, gen_);
+  std::vector<size_t> keep;
+
+  if (adaptive_)
+  {
+    std::vector<long long> bins;
+    for (auto& p : particles)
+    {
+      bins.push_back(particleBin(p, kld_bin_pix_, PI / 8));
+    }
+
+    // 2.33 is the 99% quantile of the standard normal.
+    keep = kldSample(normalized_weights, bins, min_particles_, max_particles_, kld_epsilon_, 2.33, gen_);
+    num_particles_ = keep.size();
+  }
+  else
+  {
+    keep = lowVarianceSample(num_particles_, normalized_weights, gen_);
+  }
 
   spider::SpiderList new_particles;
   std::vector<double> new_weights;
@@ -123,28 +683,295 @@ spider::SpiderList ParticleFilter::resample(const spider::SpiderList& particles,
   return new_particles;
 }
 
-spider::ParticleStateList ParticleFilter::estimate()
+void ParticleFilter::resampleMove(spider::SpiderList& particles, std::vector<double>& weights)
+{
+  switch (likelihood_)
+  {
+    case LikelihoodType::SDF:     moveParticles<SdfLikelihood>(particles, weights); break;
+    case LikelihoodType::CHAMFER: moveParticles<ChamferLikelihood>(particles, weights); break;
+    case LikelihoodType::AVERAGE: moveParticles<AverageLikelihood>(particles, weights); break;
+    // IoU is over the union of the shapes, so it doesn't factor.
+    case LikelihoodType::IOU:     break;
+  }
+}
+
+std::vector<double> ParticleFilter::factoredReweight(spider::SpiderList& particles, const float angle_std,
+                                                     const size_t num_moving)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<double> weights;
+  switch (likelihood_)
+  {
+    case LikelihoodType::SDF:     weights = sampleLegs<SdfLikelihood>(particles, angle_std, num_moving); break;
+    case LikelihoodType::CHAMFER: weights = sampleLegs<ChamferLikelihood>(particles, angle_std, num_moving); break;
+    case LikelihoodType::AVERAGE: weights = sampleLegs<AverageLikelihood>(particles, angle_std, num_moving); break;
+    case LikelihoodType::IOU:     weights = reweight(particles); break;
+  }
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  score_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  score_count_ += particles.size();
+
+  return weights;
+}
+
+template <class L>
+std::vector<double> ParticleFilter::sampleLegs(spider::SpiderList& particles, const float angle_std,
+                                               const size_t num_moving)
+{
+  const double beta = temperature();
+  const size_t half = num_joints_ / 2;
+  std::normal_distribution<float> angle_dist(0, angle_std);
+  std::uniform_real_distribution<double> pick_dist(0, 1);
+
+  std::vector<double> weights(particles.size());
+  std::vector<float> inner(leg_candidates_), outer(leg_candidates_);
+  std::vector<double> scores(leg_candidates_);
+
+  for (size_t p = 0; p < particles.size(); ++p)
+  {
+    spider::SpiderParticle& particle = particles[p];
+    if (particle.links.size() != num_joints_)
+    {
+      weights[p] = L::score(particle, obs_);
+      for (auto& view : extra_views_) weights[p] += L::score(particle, view);
+      continue;
+    }
+
+    // Legs only touch the root at the joint, so given the root each leg is
+    // sampled on its own, from the likelihood of its two links.
+    weights[p] = rootScore<L>(particle.root);
+    const size_t num_candidates = p < num_moving ? leg_candidates_ : 1;
+
+    for (size_t leg = 0; leg < half; ++leg)
+    {
+      const size_t child = leg + half;
+      const float inner0 = particle.joints[leg], outer0 = particle.joints[child];
+
+      // The first candidate is the current leg.
+      for (size_t c = 0; c < num_candidates; ++c)
+      {
+        if (c > 0)
+        {
+          particle.setJoint(leg, inner0 + angle_dist(gen_));
+          particle.setJoint(child, outer0 + angle_dist(gen_));
+        }
+
+        inner[c] = particle.joints[leg];
+        outer[c] = particle.joints[child];
+        scores[c] = linkScore<L>(particle.links[leg]) + linkScore<L>(particle.links[child]);
+      }
+
+      double max_score = *std::max_element(scores.begin(), scores.begin() + num_candidates);
+      double total = 0;
+      for (size_t c = 0; c < num_candidates; ++c) total += std::exp(beta * (scores[c] - max_score));
+
+      size_t pick = 0;
+      double u = pick_dist(gen_) * total;
+      for (; pick + 1 < num_candidates; ++pick)
+      {
+        u -= std::exp(beta * (scores[pick] - max_score));
+        if (u < 0) break;
+      }
+
+      // The pick was drawn in proportion to its likelihood, so it cancels
+      // out of the importance weight, leaving the mean likelihood of the
+      // candidates. Weights are tempered later, so undo beta here.
+      particle.setJoint(leg, inner[pick]);
+      particle.setJoint(child, outer[pick]);
+      weights[p] += max_score + std::log(total / num_candidates) / beta;
+    }
+  }
+
+  return weights;
+}
+
+template <class L>
+double ParticleFilter::rootScore(const spider::Circle& root) const
+{
+  double score = L::root(root, obs_);
+  for (auto& view : extra_views_) score += L::root(root, view);
+  return score;
+}
+
+template <class L>
+double ParticleFilter::linkScore(const spider::Rectangle& link) const
+{
+  double score = L::link(link, obs_);
+  for (auto& view : extra_views_) score += L::link(link, view);
+  return score;
+}
+
+template <class L>
+void ParticleFilter::moveParticles(spider::SpiderList& particles, std::vector<double>& weights)
+{
+  if (num_moves_ == 0 || num_joints_ == 0) return;
+
+  const double beta = temperature();
+  const size_t half = num_joints_ / 2;
+  std::uniform_int_distribution<int> joint_dist(0, num_joints_ - 1);
+  std::normal_distribution<float> angle_dist(0, move_angle_);
+  std::uniform_real_distribution<double> accept_dist(0, 1);
+
+  size_t accepted = 0;
+  std::vector<double> terms(num_joints_);
+  for (size_t p = 0; p < particles.size(); ++p)
+  {
+    spider::SpiderParticle& particle = particles[p];
+    if (particle.links.size() != num_joints_) continue;
+
+    // The score of the root doesn't change with the joints, so only the
+    // links are tracked.
+    double root = rootScore<L>(particle.root);
+    for (size_t i = 0; i < num_joints_; ++i) terms[i] = linkScore<L>(particle.links[i]);
+
+    for (size_t m = 0; m < num_moves_; ++m)
+    {
+      const size_t j = joint_dist(gen_);
+      const float old_angle = particle.joints[j];
+      const bool has_child = j < half;
+
+      particle.setJoint(j, old_angle + angle_dist(gen_));
+
+      // The proposal is symmetric, so the acceptance ratio is the tempered
+      // likelihood ratio of the links which moved.
+      double new_link = linkScore<L>(particle.links[j]);
+      double new_child = has_child ? linkScore<L>(particle.links[j + half]) : 0;
+      double delta = new_link - terms[j];
+      if (has_child) delta += new_child - terms[j + half];
+
+      if (delta >= 0 || accept_dist(gen_) < std::exp(beta * delta))
+      {
+        terms[j] = new_link;
+        if (has_child) terms[j + half] = new_child;
+        accepted++;
+      }
+      else
+      {
+        particle.setJoint(j, old_angle);
+      }
+    }
+
+    weights[p] = root;
+    for (auto& t : terms) weights[p] += t;
+  }
+
+  move_acceptance_ = particles.empty() ? 0 : static_cast<double>(accepted) / (particles.size() * num_moves_);
+}
+
+spider::SpiderList ParticleFilter::estimate()
 {
   spider::SpiderList est({particleEstimate()});
-  return spider::particlesToMap(est);
+  return est;
 }
 
 spider::SpiderParticle ParticleFilter::particleEstimate()
 {
-  if (particles_.size() != weights_.size())
+  const spider::SpiderList& particles = *particles_;
+  const std::vector<double>& weights = *weights_;
+  if (particles.size() != weights.size())
   {
-    std::cerr << "PANIC! Can't get estimate. " << particles_.size() << " != " << weights_.size() << std::endl;
+    std::cerr << "PANIC! Can't get estimate. " << particles.size() << " != " << weights.size() << std::endl;
   }
   size_t best = 0;
-  for (size_t i = 1; i < weights_.size(); ++i)
+  for (size_t i = 1; i < weights.size(); ++i)
   {
-    if (weights_[i] > weights_[best])
+    if (weights[i] > weights[best])
     {
       best = i;
     }
   }
 
-  return particles_[best];
+  return particles[best];
+}
+
+void ParticleFilter::setParticles(spider::SpiderList&& particles, std::vector<double>&& weights)
+{
+  particles_ = std::make_shared<const spider::SpiderList>(std::move(particles));
+  weights_ = std::make_shared<const std::vector<double> >(std::move(weights));
+}
+
+void ParticleFilter::publish()
+{
+  // Readers keep whichever results they loaded, so the new results are
+  // built aside and swapped in whole. The particles and weights are shared
+  // rather than copied, since the filter never changes them once set.
+  std::shared_ptr<FilterResults> results = std::make_shared<FilterResults>();
+  results->update_count = update_count_;
+  results->ess = ess_;
+  results->converged = converged_;
+  results->particles = particles_;
+  results->weights = weights_;
+  if (particles_->size() > 0 && particles_->size() == weights_->size()) results->estimate = estimate();
+
+  std::atomic_store(&published_, std::shared_ptr<const FilterResults>(results));
+}
+
+FilterSnapshot ParticleFilter::snapshot() const
+{
+  FilterSnapshot snapshot;
+  snapshot.update_count = update_count_;
+  snapshot.num_particles = num_particles_;
+  snapshot.particles = *particles_;
+  snapshot.weights = *weights_;
+  snapshot.resampled = resampled_;
+
+  std::stringstream rng;
+  rng << gen_;
+  snapshot.rng_state = rng.str();
+
+  return snapshot;
+}
+
+bool ParticleFilter::saveSnapshot(const std::string& path) const
+{
+  return writeSnapshot(path, snapshot());
+}
+
+bool ParticleFilter::saveSnapshotAsync(const std::string& path)
+{
+  // Don't stall the filter waiting on a slow disk.
+  if (pending_save_.valid() &&
+      pending_save_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    std::cerr << "Previous snapshot is still being written, skipping." << std::endl;
+    return false;
+  }
+
+  std::shared_ptr<FilterSnapshot> state = std::make_shared<FilterSnapshot>(snapshot());
+  pending_save_ = std::async(std::launch::async, [state, path]() {
+    return writeSnapshot(path, *state);
+  });
+
+  return true;
+}
+
+bool ParticleFilter::loadSnapshot(const std::string& path)
+{
+  FilterSnapshot snapshot;
+  if (!readSnapshot(path, snapshot, num_joints_)) return false;
+
+  num_particles_ = snapshot.num_particles;
+  update_count_ = snapshot.update_count;
+  setParticles(std::move(snapshot.particles), std::move(snapshot.weights));
+  resampled_ = snapshot.resampled;
+  targets_.clear();
+  converged_ = false;
+  stable_count_ = 0;
+
+  std::stringstream rng(snapshot.rng_state);
+  rng >> gen_;
+
+  publish();
+
+  return true;
+}
+
+void ParticleFilter::setCheckpoint(const std::string& path, const size_t every)
+{
+  checkpoint_path_ = path;
+  checkpoint_every_ = path.empty() ? 0 : every;
 }
 
 }  // namespace BPSandbox
@@ -5,35 +5,356 @@
 #include <string>
 #include <vector>
 #include <random>
+#include <future>
+#include <limits>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 #include "common/observation.h"
 #include "common/spider_particle.h"
+#include "common/snapshot.h"
+#include "common/likelihood.h"
 
 namespace BPSandbox
 {
 
+/**
+ * The results of the latest update, published for readers on other threads.
+ * A published state is never changed, so readers can hold on to it. The
+ * particles and weights are shared with the filter, which replaces them
+ * rather than changing them.
+ */
+struct FilterResults
+{
+  uint64_t update_count;
+  double ess;
+  bool converged;
+  std::shared_ptr<const spider::SpiderList> particles;
+  std::shared_ptr<const std::vector<double> > weights;
+  spider::SpiderList estimate;
+};
+
 class ParticleFilter
 {
 public:
   ParticleFilter();
 
-  spider::ParticleStateList init(const int num_particles, const bool use_obs = true);
-  spider::ParticleStateList update();
-  spider::ParticleStateList estimate();
+  const spider::SpiderList& init(const int num_particles, bool use_obs = true);
+  const spider::SpiderList& update();
+  spider::SpiderList estimate();
+
+  /**
+   * Initialize one particle set per observed circle, to track any number of
+   * spiders. Following calls to update() update all the targets in parallel.
+   * @param  num_particles The number of particles for each target.
+   * @return               The particles of all the targets.
+   */
+  const spider::SpiderList& initTargets(const int num_particles);
+
+  /**
+   * The best particle of each target which is likely to be a spider.
+   * @param  min_likelihood The log likelihood a target needs to be reported.
+   * @return                One estimate per detected spider.
+   */
+  spider::SpiderList estimateAll(const double min_likelihood = -40);
+
+  bool multiTarget() const { return !targets_.empty(); }
+
+  /**
+   * Write the filter state to a binary snapshot.
+   * @return True if the snapshot was written.
+   */
+  bool saveSnapshot(const std::string& path) const;
+
+  /**
+   * Write the filter state to a binary snapshot on another thread. The state
+   * is copied first, so updates can carry on while it is written.
+   * @return Whether the save started. A save is skipped if the previous one
+   *         has not finished.
+   */
+  bool saveSnapshotAsync(const std::string& path);
+
+  /**
+   * Restore the filter state from a snapshot.
+   * @return True if the snapshot was loaded.
+   */
+  bool loadSnapshot(const std::string& path);
+
+  /**
+   * Save a snapshot in the background every few updates.
+   * @param path  The snapshot file.
+   * @param every The number of updates between snapshots, or 0 to disable.
+   */
+  void setCheckpoint(const std::string& path, const size_t every);
+
+  /**
+   * Score particles against several views of the same scene. The views must
+   * share the image frame, and the joint log likelihood is the sum of the
+   * log likelihoods of the views. The first view also drives the proposals
+   * and holds the ground truth. Call init() after changing the views.
+   * @param views The observations, at least one.
+   */
+  void setObservations(const std::vector<Observation>& views);
+
+  size_t numViews() const { return 1 + extra_views_.size(); }
+  const Observation& observation() const { return obs_; }
+
+  // The current particles and weights, valid until the next step replaces them.
+  const spider::SpiderList& particles() const { return *particles_; }
+  const std::vector<double>& weights() const { return *weights_; }
+
+  /**
+   * The results of the latest init, update or snapshot load. Unlike the
+   * other accessors, this is safe to call from any thread while the filter
+   * updates: the filter publishes new results after each step and readers
+   * keep the results they loaded for as long as they need them.
+   * @return The latest results, or null before the filter is initialized.
+   */
+  std::shared_ptr<const FilterResults> published() const { return std::atomic_load(&published_); }
+
+  /**
+   * Score particles at a coarse level of the observation pyramid first, and
+   * only compute the full resolution likelihood if the coarse upper bound is
+   * within the cutoff of the best full resolution score. Particles which are
+   * not refined are weighted no higher than the worst refined one.
+   * @param enabled Whether to use coarse to fine scoring.
+   * @param level   The pyramid level used for the coarse pass.
+   * @param cutoff  Log likelihood margin below the best score at which
+   *                particles are no longer refined.
+   */
+  void setCoarseToFine(const bool enabled, const size_t level, const double cutoff);
+
+  /**
+   * Choose the likelihood used to weight particles. The coarse to fine pass
+   * only applies to the SDF likelihood.
+   */
+  void setLikelihood(const LikelihoodType type);
+  LikelihoodType likelihood() const { return likelihood_; }
+
+  /**
+   * The average time spent scoring a particle since init(), in microseconds.
+   */
+  double likelihoodCost() const;
+
+  /**
+   * The pose error of the estimate against the ground truth of the
+   * observation, in pixels, or NaN if there is no ground truth.
+   */
+  double poseError();
+
+  /**
+   * Score the current particles with every likelihood, to compare their cost
+   * and accuracy on the same particles. The filter state is not changed.
+   */
+  std::vector<LikelihoodReport> profileLikelihoods() const;
+
+  /**
+   * Set the standard deviations of the noise added to particles at each
+   * update. The defaults are 2 pixels, 0.1 radians and 2 pixels.
+   * @param pix   The noise on the root position, in pixels.
+   * @param angle The noise on the joint angles, in radians.
+   * @param param The noise on the shape sizes, in pixels.
+   */
+  void setJitter(const float pix, const float angle, const float param);
+
+  /**
+   * Anneal the filter: weights are tempered by raising the likelihood to a
+   * power beta which grows to 1, and the jitter shrinks, with each update.
+   * Early updates explore broadly and later ones refine. The filter only
+   * converges once beta reaches 1.
+   * @param enabled      Whether to anneal.
+   * @param beta0        The likelihood exponent of the first update.
+   * @param beta_rate    Factor applied to beta at each update.
+   * @param jitter_decay Factor applied to the jitter scale at each update.
+   * @param min_jitter   The smallest jitter scale.
+   */
+  void setAnnealing(const bool enabled, const double beta0 = 0.1, const double beta_rate = 1.5,
+                    const double jitter_decay = 0.8, const double min_jitter = 0.1);
+
+  /**
+   * The likelihood exponent and jitter scale of the next update.
+   */
+  double temperature() const;
+  double jitterScale() const;
+
+  /**
+   * Follow each resampling with Metropolis-Hastings moves, which perturb one
+   * joint of a particle at a time and accept the move by its likelihood
+   * ratio. Resampling duplicates the good particles, and the moves spread the
+   * copies out again without lowering the weights. Only the links moved by a
+   * joint are rescored, so a move costs a fraction of a full score. Moves
+   * need a likelihood which factors over the shapes, so they are skipped for
+   * IoU, and they only apply to single target mode.
+   * @param enabled   Whether to move particles after resampling.
+   * @param num_moves The number of moves per particle.
+   * @param angle_std The standard deviation of a move, in radians.
+   */
+  void setResampleMove(const bool enabled, const size_t num_moves = 8, const float angle_std = 0.2);
+
+  /**
+   * The fraction of moves accepted in the last update.
+   */
+  double moveAcceptance() const { return move_acceptance_; }
+
+  /**
+   * Propose the root and the legs separately. The root pose and shape sizes
+   * are jittered as before, but instead of jittering every joint at once each
+   * leg draws a few candidate pairs of joint angles, scores them with the
+   * likelihood of its two links only, and keeps one in proportion to that
+   * likelihood, as the nodes of the Python SpiderGraph do. A particle is then
+   * weighted by its root and the mean likelihood of each leg's candidates,
+   * the importance weight of that proposal. This needs a likelihood which
+   * factors over the shapes, so it is ignored for IoU.
+   * @param enabled        Whether to use factored proposals.
+   * @param num_candidates The number of candidates per leg, including the
+   *                       current one.
+   */
+  void setFactored(const bool enabled, const size_t num_candidates = 4);
+
+  /**
+   * Set the fraction of particles which are replaced by proposals built from
+   * the observed blobs at each update.
+   */
+  void setProposalRate(const double rate);
+
+  /**
+   * Let resampling grow or shrink the particle set using KLD-sampling.
+   * @param enabled       Whether to adapt the number of particles.
+   * @param min_particles The lower limit on the number of particles.
+   * @param max_particles The upper limit on the number of particles.
+   * @param epsilon       The bound on the KL divergence of the sample set.
+   * @param bin_pix       The bin size for the root position, in pixels.
+   */
+  void setAdaptive(const bool enabled, const size_t min_particles, const size_t max_particles,
+                   const double epsilon = 0.05, const float bin_pix = 5);
+
+  size_t numParticles() const { return num_particles_; }
+
+  /**
+   * Only resample when the effective sample size drops below a fraction of
+   * the number of particles.
+   */
+  void setResampleThreshold(const double ess_fraction);
+
+  /**
+   * Stop updating once the estimate has settled. The filter is converged
+   * when, for the given number of consecutive updates, the root of the
+   * estimate moves less than the tolerance and the best log likelihood
+   * improves by less than the weight tolerance.
+   * @param enabled       Whether to detect convergence.
+   * @param tolerance_pix The largest root motion of a stable update, in pixels.
+   * @param tolerance_w   The largest best log likelihood gain of a stable update.
+   * @param patience      The number of stable updates needed.
+   */
+  void setConvergence(const bool enabled, const float tolerance_pix,
+                      const double tolerance_w, const size_t patience);
+
+  bool converged() const { return converged_; }
+  size_t updateCount() const { return update_count_; }
+  double effectiveSampleSize() const { return ess_; }
+  // Whether the last update resampled the particles.
+  bool resampled() const { return resampled_; }
 
 private:
+  /**
+   * The particle set of one target in multi-target mode.
+   */
+  struct Target
+  {
+    spider::SpiderList particles;
+    std::vector<double> weights;
+    // Targets are updated in parallel, so each draws from its own generator,
+    // seeded from the filter's.
+    std::mt19937 gen;
+  };
+
+  const spider::SpiderList& updateTargets();
+  void updateTarget(Target& target) const;
   spider::SpiderParticle particleEstimate();
   spider::SpiderParticle randomParticle(const float x, const float y, const float r);
-  std::vector<double> reweight(const spider::SpiderList& particles, const Observation& obs);
+  spider::SpiderParticle proposeParticle(const size_t circle_idx, std::mt19937& gen);
+  std::vector<double> reweight(const spider::SpiderList& particles) const;
+  std::vector<double> reweightView(const spider::SpiderList& particles, const Observation& obs) const;
+  std::vector<double> coarseToFine(const spider::SpiderList& particles, const Observation& obs) const;
+  std::vector<double> temper(const std::vector<double>& weights) const;
   spider::SpiderList resample(const spider::SpiderList& particles, std::vector<double>& weights);
+  void resampleMove(spider::SpiderList& particles, std::vector<double>& weights);
+  template <class L>
+  void moveParticles(spider::SpiderList& particles, std::vector<double>& weights);
+  std::vector<double> factoredReweight(spider::SpiderList& particles, const float angle_std, const size_t num_moving);
+  template <class L>
+  std::vector<double> sampleLegs(spider::SpiderList& particles, const float angle_std, const size_t num_moving);
+  template <class L>
+  double rootScore(const spider::Circle& root) const;
+  template <class L>
+  double linkScore(const spider::Rectangle& link) const;
+  void checkConvergence(const double best_w);
+  void setParticles(spider::SpiderList&& particles, std::vector<double>&& weights);
+  void publish();
+  FilterSnapshot snapshot() const;
 
   size_t num_particles_;
   size_t update_count_;
   size_t num_joints_;
 
+  LikelihoodType likelihood_;
+  // Scoring time and count, updated from the target threads too.
+  mutable std::atomic<uint64_t> score_ns_, score_count_;
+
+  bool coarse_to_fine_;
+  size_t coarse_level_;
+  double coarse_cutoff_;
+  double proposal_rate_;
+  float jitter_pix_, jitter_angle_, jitter_param_;
+
+  bool anneal_;
+  double anneal_beta0_, anneal_beta_rate_;
+  double anneal_jitter_decay_, anneal_min_jitter_;
+
+  bool resample_move_;
+  size_t num_moves_;
+  float move_angle_;
+  double move_acceptance_;
+
+  bool factored_;
+  size_t leg_candidates_;
+
+  bool adaptive_;
+  size_t min_particles_, max_particles_;
+  double kld_epsilon_;
+  float kld_bin_pix_;
+
+  double ess_threshold_;
+  double ess_;
+  bool resampled_;
+
+  bool detect_convergence_;
+  bool converged_;
+  float convergence_pix_;
+  double convergence_w_;
+  size_t convergence_patience_;
+  size_t stable_count_;
+  float last_x_, last_y_;
+  double last_best_w_;
+
+  std::string checkpoint_path_;
+  size_t checkpoint_every_;
+  std::future<bool> pending_save_;
+
+  std::mt19937 gen_;
+
   Observation obs_;
-  spider::SpiderList particles_;
-  std::vector<double> weights_;
+  std::vector<Observation> extra_views_;
+  // Replaced as a whole by each step, never changed in place, so they can be
+  // published without a copy.
+  std::shared_ptr<const spider::SpiderList> particles_;
+  std::shared_ptr<const std::vector<double> > weights_;
+  std::vector<Target> targets_;
+
+  // Only swapped with std::atomic_store, and read with std::atomic_load.
+  std::shared_ptr<const FilterResults> published_;
 };
 
 }  // namespace BPSandbox
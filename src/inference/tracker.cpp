@@ -0,0 +1,130 @@
+#include "tracker.h"
+#include "particle_filter.h"
+
+namespace BPSandbox
+{
+
+struct Tracker::Impl
+{
+  Impl() :
+    initialized(false),
+    image_changed(false)
+  {
+  }
+
+  /**
+   * Hand the current image to the filter, once per change.
+   */
+  void syncObservation()
+  {
+    if (!image_changed) return;
+    pf.setObservations({*obs});
+    image_changed = false;
+  }
+
+  TrackerOptions options;
+  ParticleFilter pf;
+  // Null until the first image.
+  std::unique_ptr<Observation> obs;
+  bool initialized, image_changed;
+};
+
+Tracker::Tracker(const TrackerOptions& options) :
+  impl_(new Impl())
+{
+  impl_->options = options;
+
+  LikelihoodType likelihood;
+  if (parseLikelihood(options.likelihood, likelihood)) impl_->pf.setLikelihood(likelihood);
+
+  const float scale = options.jitter_scale;
+  impl_->pf.setJitter(2 * scale, 0.1 * scale, 2 * scale);
+  impl_->pf.setAnnealing(options.anneal);
+  impl_->pf.setFactored(options.factored);
+  impl_->pf.setResampleMove(options.resample_move);
+}
+
+Tracker::~Tracker()
+{
+}
+
+bool Tracker::setImage(const uint8_t* pixels, const size_t width, const size_t height, const size_t stride)
+{
+  if (pixels == nullptr || width == 0 || height == 0) return false;
+
+  impl_->obs.reset(new Observation(pixels, width, height, stride));
+  impl_->image_changed = true;
+
+  return true;
+}
+
+void Tracker::addCircle(const float x, const float y, const float radius)
+{
+  if (!impl_->obs) return;
+
+  // Blobs are stored like the data files, by (row, col).
+  impl_->obs->addCircle({y, x, radius});
+  impl_->image_changed = true;
+}
+
+void Tracker::addRectangle(const float x, const float y, const float theta, const float width, const float height)
+{
+  if (!impl_->obs) return;
+
+  // The data files measure the angle from the row axis.
+  impl_->obs->addRectangle({y, x, normalize_angle(PI / 2 - theta), width, height});
+  impl_->image_changed = true;
+}
+
+bool Tracker::init()
+{
+  if (!impl_->obs) return false;
+
+  impl_->syncObservation();
+  impl_->pf.init(impl_->options.num_particles, impl_->options.informed);
+  impl_->initialized = true;
+
+  return true;
+}
+
+bool Tracker::update()
+{
+  if (!impl_->initialized) return false;
+
+  impl_->syncObservation();
+  impl_->pf.update();
+
+  return true;
+}
+
+bool Tracker::estimate(SpiderPose& pose) const
+{
+  std::shared_ptr<const FilterResults> results = impl_->pf.published();
+  if (!results || results->estimate.empty()) return false;
+
+  const spider::SpiderParticle& best = results->estimate[0];
+  pose.x = best.x;
+  pose.y = best.y;
+  pose.radius = best.root.radius;
+  pose.joints = best.joints;
+
+  pose.links.clear();
+  for (auto& l : best.links) pose.links.push_back({l.x, l.y, l.theta, l.width, l.height});
+
+  const std::vector<double>& weights = *results->weights;
+  pose.log_likelihood = weights.empty() ? 0 : *std::max_element(weights.begin(), weights.end());
+
+  return true;
+}
+
+size_t Tracker::updateCount() const
+{
+  return impl_->pf.updateCount();
+}
+
+bool Tracker::converged() const
+{
+  return impl_->pf.converged();
+}
+
+}  // namespace BPSandbox
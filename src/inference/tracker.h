@@ -0,0 +1,130 @@
+#ifndef BP_SANDBOX_INFERENCE_TRACKER_H
+#define BP_SANDBOX_INFERENCE_TRACKER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace BPSandbox
+{
+
+/**
+ * Options of a Tracker. The defaults match those of the server.
+ */
+struct TrackerOptions
+{
+  TrackerOptions() :
+    num_particles(100),
+    likelihood("sdf"),
+    informed(true),
+    jitter_scale(1),
+    anneal(false),
+    factored(false),
+    resample_move(false)
+  {
+  }
+
+  size_t num_particles;
+  // One of "sdf", "chamfer", "iou" or "average". Unknown names use "sdf".
+  std::string likelihood;
+  // Start the particles on the detected circles, when there are any.
+  bool informed;
+  float jitter_scale;
+  bool anneal;
+  bool factored;
+  bool resample_move;
+};
+
+/**
+ * A link of an estimated spider, in image coordinates.
+ */
+struct LinkPose
+{
+  float x, y, theta;
+  float width, height;
+};
+
+/**
+ * An estimated spider, in image coordinates.
+ */
+struct SpiderPose
+{
+  float x, y, radius;
+  std::vector<float> joints;
+  std::vector<LinkPose> links;
+  double log_likelihood;
+};
+
+/**
+ * Tracks a spider in images held by the caller, without the server. This is
+ * the stable interface of the bp_inference library: it only exposes plain
+ * types, so callers don't need Eigen or the filter headers.
+ *
+ * A frame is given with setImage(), optionally with the blobs detected in
+ * it, then init() starts the filter and each update() refines it. Later
+ * frames can be given between updates to keep tracking.
+ */
+class Tracker
+{
+public:
+  explicit Tracker(const TrackerOptions& options = TrackerOptions());
+  ~Tracker();
+
+  /**
+   * Set the image the filter scores against. The pixels are copied, so the
+   * buffer can be reused once this returns. The blobs of the previous image
+   * are cleared.
+   * @param pixels The image, one byte per pixel by rows. Nonzero pixels are
+   *               occupied.
+   * @param width  The number of columns.
+   * @param height The number of rows.
+   * @param stride The number of bytes from one row to the next, or 0 if the
+   *               rows are packed.
+   * @return       False if the image is empty.
+   */
+  bool setImage(const uint8_t* pixels, const size_t width, const size_t height, const size_t stride = 0);
+
+  /**
+   * Add a circle detected in the current image, used to propose roots.
+   */
+  void addCircle(const float x, const float y, const float radius);
+
+  /**
+   * Add a rectangle detected in the current image, used to propose legs.
+   * @param theta The angle of the long side from the x axis, in radians.
+   */
+  void addRectangle(const float x, const float y, const float theta, const float width, const float height);
+
+  /**
+   * Start the filter on the current image.
+   * @return False if there is no image.
+   */
+  bool init();
+
+  /**
+   * Run one update on the current image.
+   * @return False if the filter has not been initialized.
+   */
+  bool update();
+
+  /**
+   * The best particle of the latest update.
+   * @return False if the filter has not been initialized.
+   */
+  bool estimate(SpiderPose& pose) const;
+
+  size_t updateCount() const;
+  bool converged() const;
+
+private:
+  Tracker(const Tracker&);
+  Tracker& operator=(const Tracker&);
+
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace BPSandbox
+
+#endif  // BP_SANDBOX_INFERENCE_TRACKER_H
@@ -0,0 +1,425 @@
+#ifndef BP_SANDBOX_JSON_VIEW_H
+#define BP_SANDBOX_JSON_VIEW_H
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+
+/**
+ * Read-only view of a JSON value inside a buffer. Parsing only finds where
+ * values start and end, and nothing is copied until a string is requested,
+ * so the buffer must outlive the view.
+ */
+class JsonView
+{
+public:
+    enum Type { INVALID, OBJECT, ARRAY, STRING, NUMBER, BOOLEAN, NUL };
+
+    JsonView() :
+      type_(INVALID),
+      begin_(nullptr),
+      end_(nullptr)
+    {
+    }
+
+    /**
+     * Parse the first value in a buffer. The view is invalid if the value is
+     * not well formed.
+     * @param begin The start of the buffer.
+     * @param end   One past the end of the buffer.
+     */
+    JsonView(const char* begin, const char* end) :
+      type_(INVALID),
+      begin_(nullptr),
+      end_(nullptr)
+    {
+        const char* p = skipSpace(begin, end);
+        const char* value_end = skipValue(p, end, 0);
+        if (value_end != nullptr) set(p, value_end);
+    }
+
+    Type type() const { return type_; }
+    bool valid() const { return type_ != INVALID; }
+    bool isObject() const { return type_ == OBJECT; }
+    bool isArray() const { return type_ == ARRAY; }
+    bool isString() const { return type_ == STRING; }
+    bool isNumber() const { return type_ == NUMBER; }
+
+    /**
+     * The raw text of the value, including the quotes of strings.
+     */
+    const char* begin() const { return begin_; }
+    const char* end() const { return end_; }
+
+    /**
+     * Member of an object, or an invalid view if there is no such key.
+     */
+    JsonView get(const char* key) const
+    {
+        if (type_ != OBJECT) return JsonView();
+
+        const size_t key_len = strlen(key);
+        JsonView k, v;
+        const char* p = begin_ + 1;
+        while ((p = nextMember(p, k, v)) != nullptr)
+        {
+            if (k.equals(key, key_len)) return v;
+        }
+
+        return JsonView();
+    }
+
+    bool has(const char* key) const
+    {
+        return get(key).valid();
+    }
+
+    /**
+     * The number of elements of an array or members of an object.
+     */
+    size_t size() const
+    {
+        size_t count = 0;
+        JsonView k, v;
+        const char* p = begin_ + 1;
+
+        if (type_ == OBJECT)
+        {
+            while ((p = nextMember(p, k, v)) != nullptr) count++;
+        }
+        else if (type_ == ARRAY)
+        {
+            while ((p = nextElement(p, v)) != nullptr) count++;
+        }
+
+        return count;
+    }
+
+    /**
+     * Element of an array, or an invalid view if out of range.
+     */
+    JsonView at(const size_t idx) const
+    {
+        if (type_ != ARRAY) return JsonView();
+
+        JsonView v;
+        const char* p = begin_ + 1;
+        for (size_t i = 0; (p = nextElement(p, v)) != nullptr; ++i)
+        {
+            if (i == idx) return v;
+        }
+
+        return JsonView();
+    }
+
+    /**
+     * Visit the elements of an array in order, which is linear in the size of
+     * the array unlike repeated calls to at().
+     * @param f Called with each element.
+     */
+    template <class Func>
+    void forEach(Func f) const
+    {
+        if (type_ != ARRAY) return;
+
+        JsonView v;
+        const char* p = begin_ + 1;
+        while ((p = nextElement(p, v)) != nullptr) f(v);
+    }
+
+    /**
+     * Visit the members of an object in order.
+     * @param f Called with the key and value of each member.
+     */
+    template <class Func>
+    void forEachMember(Func f) const
+    {
+        if (type_ != OBJECT) return;
+
+        JsonView k, v;
+        const char* p = begin_ + 1;
+        while ((p = nextMember(p, k, v)) != nullptr) f(k, v);
+    }
+
+    double asDouble(const double default_val = 0) const
+    {
+        if (type_ == BOOLEAN) return *begin_ == 't' ? 1 : 0;
+        if (type_ == STRING) return JsonView(begin_ + 1, end_ - 1).asDouble(default_val);
+        if (type_ != NUMBER) return default_val;
+
+        const char* p = begin_;
+        double sign = 1;
+        if (*p == '-')
+        {
+            sign = -1;
+            p++;
+        }
+
+        double val = 0;
+        for (; p < end_ && isDigit(*p); ++p) val = val * 10 + (*p - '0');
+
+        if (p < end_ && *p == '.')
+        {
+            double scale = 0.1;
+            for (++p; p < end_ && isDigit(*p); ++p, scale *= 0.1) val += (*p - '0') * scale;
+        }
+
+        if (p < end_ && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            int exp_sign = 1, exp = 0;
+            if (p < end_ && (*p == '-' || *p == '+')) exp_sign = *p++ == '-' ? -1 : 1;
+            // Past a few hundred the value is already zero or infinite.
+            for (; p < end_ && isDigit(*p); ++p) exp = std::min(1000, exp * 10 + (*p - '0'));
+            val *= std::pow(10.0, exp_sign * exp);
+        }
+
+        return sign * val;
+    }
+
+    int asInt(const int default_val = 0) const
+    {
+        if (type_ != NUMBER && type_ != BOOLEAN && type_ != STRING) return default_val;
+
+        // Values an int can't hold, or NaN, would be undefined to convert.
+        const double val = std::round(asDouble(default_val));
+        if (!(val >= std::numeric_limits<int>::min() && val <= std::numeric_limits<int>::max())) return default_val;
+        return static_cast<int>(val);
+    }
+
+    /**
+     * Booleans, or numbers which are true when non-zero.
+     */
+    bool asBool(const bool default_val = false) const
+    {
+        if (type_ == BOOLEAN) return *begin_ == 't';
+        if (type_ == NUMBER || type_ == STRING) return asDouble(default_val) != 0;
+        return default_val;
+    }
+
+    /**
+     * The unescaped contents of a string, or the raw text of other values.
+     */
+    std::string asString() const
+    {
+        if (type_ != STRING) return std::string(begin_, end_);
+
+        std::string s;
+        s.reserve(end_ - begin_ - 2);
+        for (const char* p = begin_ + 1; p < end_ - 1; ++p)
+        {
+            if (*p != '\\')
+            {
+                s.push_back(*p);
+                continue;
+            }
+
+            switch (*++p)
+            {
+            case 'n': s.push_back('\n'); break;
+            case 't': s.push_back('\t'); break;
+            case 'r': s.push_back('\r'); break;
+            case 'b': s.push_back('\b'); break;
+            case 'f': s.push_back('\f'); break;
+            case 'u':
+            {
+                // ASCII escapes, such as the control characters JsonWriter
+                // escapes, are decoded. Non-ASCII is not needed.
+                int code = 0;
+                for (int i = 1; i <= 4 && p + i < end_ - 1; ++i) code = code * 16 + hexValue(p[i]);
+                s.push_back(code >= 0 && code < 0x80 ? static_cast<char>(code) : '?');
+                p += 4;
+                break;
+            }
+            default:  s.push_back(*p);
+            }
+        }
+
+        return s;
+    }
+
+    /**
+     * Compare the contents of a string without copying it.
+     */
+    bool equals(const char* str, const size_t len) const
+    {
+        if (type_ != STRING) return false;
+        return static_cast<size_t>(end_ - begin_ - 2) == len && strncmp(begin_ + 1, str, len) == 0;
+    }
+
+    bool equals(const char* str) const
+    {
+        return equals(str, strlen(str));
+    }
+
+private:
+    // Deeper values are rejected so malicious input can't exhaust the stack.
+    static const int MAX_DEPTH = 64;
+
+    Type type_;
+    const char* begin_;
+    const char* end_;
+
+    void set(const char* begin, const char* end)
+    {
+        begin_ = begin;
+        end_ = end;
+
+        switch (*begin)
+        {
+        case '{': type_ = OBJECT; break;
+        case '[': type_ = ARRAY; break;
+        case '"': type_ = STRING; break;
+        case 't':
+        case 'f': type_ = BOOLEAN; break;
+        case 'n': type_ = NUL; break;
+        default:  type_ = NUMBER;
+        }
+    }
+
+    /**
+     * Read the member starting at or after p, which is inside this object.
+     * @return One past the member and its separator, or nullptr at the end.
+     */
+    const char* nextMember(const char* p, JsonView& key, JsonView& value) const
+    {
+        p = skipSpace(p, end_ - 1);
+        if (p >= end_ - 1 || *p != '"') return nullptr;
+
+        const char* key_end = skipString(p, end_);
+        key.set(p, key_end);
+
+        p = skipSpace(key_end, end_) + 1;  // Skip the ':'.
+        p = skipSpace(p, end_);
+        const char* value_end = skipValue(p, end_, 0);
+        value.set(p, value_end);
+
+        p = skipSpace(value_end, end_);
+        if (*p == ',') p++;
+        return p;
+    }
+
+    /**
+     * Read the element starting at or after p, which is inside this array.
+     * @return One past the element and its separator, or nullptr at the end.
+     */
+    const char* nextElement(const char* p, JsonView& value) const
+    {
+        p = skipSpace(p, end_ - 1);
+        if (p >= end_ - 1) return nullptr;
+
+        const char* value_end = skipValue(p, end_, 0);
+        value.set(p, value_end);
+
+        p = skipSpace(value_end, end_);
+        if (*p == ',') p++;
+        return p;
+    }
+
+    static bool isDigit(const char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    /**
+     * The value of a hex digit, or a large negative number if it is not one.
+     */
+    static int hexValue(const char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -0x10000;
+    }
+
+    static const char* skipSpace(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+        return p;
+    }
+
+    static const char* skipString(const char* p, const char* end)
+    {
+        for (++p; p < end; ++p)
+        {
+            if (*p == '\\') p++;
+            else if (*p == '"') return p + 1;
+        }
+        return nullptr;
+    }
+
+    static const char* skipLiteral(const char* p, const char* end, const char* literal)
+    {
+        const size_t len = strlen(literal);
+        if (static_cast<size_t>(end - p) < len || strncmp(p, literal, len) != 0) return nullptr;
+        return p + len;
+    }
+
+    static const char* skipNumber(const char* p, const char* end)
+    {
+        const char* start = p;
+        if (p < end && *p == '-') p++;
+        while (p < end && isDigit(*p)) p++;
+        if (p < end && *p == '.') for (++p; p < end && isDigit(*p); ++p);
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            if (p < end && (*p == '-' || *p == '+')) p++;
+            while (p < end && isDigit(*p)) p++;
+        }
+
+        if (p == start || (p == start + 1 && *start == '-')) return nullptr;
+        return p;
+    }
+
+    /**
+     * Find the end of the value starting at p, checking it is well formed.
+     * @return One past the end of the value, or nullptr if it is invalid.
+     */
+    static const char* skipValue(const char* p, const char* end, const int depth)
+    {
+        if (p >= end || depth > MAX_DEPTH) return nullptr;
+
+        switch (*p)
+        {
+        case '"': return skipString(p, end);
+        case 't': return skipLiteral(p, end, "true");
+        case 'f': return skipLiteral(p, end, "false");
+        case 'n': return skipLiteral(p, end, "null");
+        case '{':
+        case '[':
+        {
+            const bool object = *p == '{';
+            const char close = object ? '}' : ']';
+
+            p = skipSpace(p + 1, end);
+            if (p < end && *p == close) return p + 1;
+
+            while (p < end)
+            {
+                if (object)
+                {
+                    if (*p != '"' || (p = skipString(p, end)) == nullptr) return nullptr;
+                    p = skipSpace(p, end);
+                    if (p >= end || *p != ':') return nullptr;
+                    p = skipSpace(p + 1, end);
+                }
+
+                if ((p = skipValue(p, end, depth + 1)) == nullptr) return nullptr;
+                p = skipSpace(p, end);
+
+                if (p >= end) return nullptr;
+                if (*p == close) return p + 1;
+                if (*p != ',') return nullptr;
+                p = skipSpace(p + 1, end);
+            }
+            return nullptr;
+        }
+        default: return skipNumber(p, end);
+        }
+    }
+};
+
+#endif  // BP_SANDBOX_JSON_VIEW_H
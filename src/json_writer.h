@@ -0,0 +1,228 @@
+#ifndef BP_SANDBOX_JSON_WRITER_H
+#define BP_SANDBOX_JSON_WRITER_H
+
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * Streams JSON into an output stream through a small local buffer. Commas
+ * are added automatically and numbers are formatted with a fixed number of
+ * decimals, without going through the locale.
+ */
+class JsonWriter
+{
+public:
+    /**
+     * @param out       The stream to write to.
+     * @param precision The number of decimals written for numbers, up to 9.
+     */
+    JsonWriter(std::ostream& out, const int precision = 3) :
+      out_(out),
+      size_(0),
+      depth_(0),
+      precision_(std::min(9, std::max(0, precision))),
+      scale_(1)
+    {
+        for (int i = 0; i < precision_; ++i) scale_ *= 10;
+        first_[0] = true;
+    }
+
+    ~JsonWriter()
+    {
+        flush();
+    }
+
+    void beginObject() { open('{'); }
+    void endObject() { close('}'); }
+    void beginArray() { open('['); }
+    void endArray() { close(']'); }
+
+    void key(const std::string& k)
+    {
+        separate();
+        writeString(k);
+        put(':');
+        // The value follows the key without a comma.
+        first_[depth_] = true;
+    }
+
+    void value(const std::string& v)
+    {
+        separate();
+        writeString(v);
+    }
+
+    void value(const char* v)
+    {
+        value(std::string(v));
+    }
+
+    void value(const double v)
+    {
+        separate();
+        writeNumber(v);
+    }
+
+    void boolean(const bool v)
+    {
+        separate();
+        write(v ? "true" : "false");
+    }
+
+    /**
+     * Write an array of numbers.
+     */
+    template <class Container>
+    void array(const Container& vals)
+    {
+        beginArray();
+        for (auto& v : vals) value(static_cast<double>(v));
+        endArray();
+    }
+
+    void flush()
+    {
+        if (size_ > 0) out_.write(buffer_, size_);
+        size_ = 0;
+    }
+
+private:
+    static const size_t BUFFER_SIZE = 4096;
+    static const int MAX_DEPTH = 32;
+
+    std::ostream& out_;
+    char buffer_[BUFFER_SIZE];
+    size_t size_;
+
+    // Whether the next value at each nesting level is the first one.
+    bool first_[MAX_DEPTH + 1];
+    int depth_;
+
+    int precision_;
+    uint64_t scale_;
+
+    void put(const char c)
+    {
+        if (size_ == BUFFER_SIZE) flush();
+        buffer_[size_++] = c;
+    }
+
+    void write(const char* s, const size_t len)
+    {
+        if (size_ + len > BUFFER_SIZE) flush();
+        if (len > BUFFER_SIZE)
+        {
+            out_.write(s, len);
+            return;
+        }
+        memcpy(buffer_ + size_, s, len);
+        size_ += len;
+    }
+
+    void write(const char* s)
+    {
+        write(s, strlen(s));
+    }
+
+    void separate()
+    {
+        if (!first_[depth_]) put(',');
+        first_[depth_] = false;
+    }
+
+    void open(const char c)
+    {
+        separate();
+        put(c);
+        if (depth_ < MAX_DEPTH) depth_++;
+        first_[depth_] = true;
+    }
+
+    void close(const char c)
+    {
+        put(c);
+        if (depth_ > 0) depth_--;
+    }
+
+    void writeString(const std::string& s)
+    {
+        put('"');
+        for (auto& c : s)
+        {
+            if (c == '"' || c == '\\') put('\\');
+            if (c == '\n')
+            {
+                write("\\n", 2);
+                continue;
+            }
+            // JSON doesn't allow raw control characters in strings.
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                static const char* hex = "0123456789abcdef";
+                const char escaped[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+                write(escaped, 6);
+                continue;
+            }
+            put(c);
+        }
+        put('"');
+    }
+
+    void writeNumber(double v)
+    {
+        if (!std::isfinite(v))
+        {
+            write("null", 4);
+            return;
+        }
+
+        // Fixed point would overflow, so fall back on printf.
+        if (std::abs(v) * scale_ >= 1e18)
+        {
+            char big[32];
+            int len = snprintf(big, sizeof(big), "%.17g", v);
+            write(big, len);
+            return;
+        }
+
+        bool negative = v < 0;
+        uint64_t scaled = static_cast<uint64_t>(std::abs(v) * scale_ + 0.5);
+        uint64_t whole = scaled / scale_;
+        uint64_t frac = scaled % scale_;
+        if (scaled == 0) negative = false;
+
+        // Digits are written backwards from the end of the buffer.
+        char digits[32];
+        char* p = digits + sizeof(digits);
+
+        // Trailing zeros of the fraction are dropped.
+        int num_frac = precision_;
+        while (num_frac > 0 && frac % 10 == 0)
+        {
+            frac /= 10;
+            num_frac--;
+        }
+        if (num_frac > 0)
+        {
+            for (int i = 0; i < num_frac; ++i, frac /= 10) *--p = '0' + frac % 10;
+            *--p = '.';
+        }
+
+        do
+        {
+            *--p = '0' + whole % 10;
+            whole /= 10;
+        } while (whole > 0);
+
+        if (negative) *--p = '-';
+
+        write(p, digits + sizeof(digits) - p);
+    }
+};
+
+#endif  // BP_SANDBOX_JSON_WRITER_H
@@ -1,10 +1,15 @@
 #include <memory>
 #include <future>
+#include <mutex>
+#include <deque>
+
+#include <sys/stat.h>
 
 #include <simple-websocket-server/client_ws.hpp>
 #include <simple-websocket-server/server_ws.hpp>
 
 #include "inference/particle_filter.h"
+#include "inference/common/inference_utils.h"
 
 #include "server_utils.h"
 
@@ -14,61 +19,450 @@ using WsClient = SimpleWeb::SocketClient<SimpleWeb::WS>;
 class ServerHelper
 {
 public:
-    ServerHelper()
+    ServerHelper() :
+      max_in_flight_(1),
+      data_dir_("/home/jana/code/bp-sandbox/data"),
+      snapshot_dir_("snapshots")
     {
+        mkdir(snapshot_dir_.c_str(), 0755);
+
+        // Clients which don't send observations get the default scene.
+        pf.setObservations({BPSandbox::Observation(data_dir_ + "/obs.pbm", data_dir_ + "/obs_data.txt")});
     }
 
     BPSandbox::ParticleFilter pf;
 
-    void sendParticleMessage(std::shared_ptr<WsServer::Connection>& connection, const ParticleMessage& msg)
+    /**
+     * Options for reducing the particles sent in a message.
+     */
+    struct LevelOfDetail
     {
-        connection->send(msg.toJSONString(), [](const SimpleWeb::error_code &ec) {
-        if(ec) {
-            std::cout << "Server: Error sending message. " <<
-                // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                "Error: " << ec << ", error message: " << ec.message() << std::endl;
-            }
+        LevelOfDetail() :
+          mode("stratified"),
+          max_send(500),
+          cell(4)
+        {
+        }
+
+        std::string mode;
+        size_t max_send;
+        float cell;
+    };
+
+    /**
+     * Read the level of detail options used to broadcast particles.
+     */
+    static void readLevelOfDetail(const InMessageHelper& in_msg, LevelOfDetail& lod)
+    {
+        if (in_msg.hasKey("lod")) lod.mode = in_msg.getVal("lod");
+        if (in_msg.hasKey("max_send")) lod.max_send = std::max(1, in_msg.getInt("max_send"));
+        if (in_msg.hasKey("density_cell")) lod.cell = std::max(1.0, in_msg.getDouble("density_cell"));
+    }
+
+    void setLevelOfDetail(const InMessageHelper& in_msg)
+    {
+        readLevelOfDetail(in_msg, lod_);
+    }
+
+    /**
+     * Add the latest particles of the filter and its estimate to a message.
+     */
+    void setParticlesLOD(ParticleMessage& msg)
+    {
+        std::shared_ptr<const BPSandbox::FilterResults> results = pf.published();
+        if (results) addResults(msg, lod_, results);
+    }
+
+    /**
+     * Add published particles and their estimate to a message. The message
+     * shares the published lists, so nothing is copied when all the
+     * particles are sent.
+     */
+    static void addResults(ParticleMessage& msg, const LevelOfDetail& lod,
+                           const std::shared_ptr<const BPSandbox::FilterResults>& results)
+    {
+        msg.setEstimate(std::shared_ptr<const BPSandbox::spider::SpiderList>(results, &results->estimate));
+        addParticlesLOD(msg, lod, results->particles, *results->weights);
+    }
+
+    /**
+     * Add particles to a message, keeping at most the maximum number. The
+     * larger particle sets are reduced to the best particles ("top"), a
+     * stratified sample ("stratified"), or a histogram of the roots
+     * ("density"), depending on the mode. The "all" mode sends everything.
+     * @param msg       The message.
+     * @param lod       The level of detail.
+     * @param particles The particles.
+     * @param weights   The weights of the particles.
+     */
+    static void addParticlesLOD(ParticleMessage& msg, const LevelOfDetail& lod,
+                                const std::shared_ptr<const BPSandbox::spider::SpiderList>& particles,
+                                const std::vector<double>& weights)
+    {
+        if (lod.mode == "all" || particles->size() <= lod.max_send)
+        {
+            msg.setParticles(particles);
+            return;
+        }
+
+        if (lod.mode == "density")
+        {
+            msg.particles["density"] = BPSandbox::rootDensity(*particles, lod.cell);
+            return;
+        }
+
+        std::vector<size_t> keep;
+        if (lod.mode == "top")
+        {
+            keep = BPSandbox::topWeightIndices(weights, lod.max_send);
+        }
+        else
+        {
+            // Duplicates would be drawn on top of each other, so only send
+            // each sampled particle once.
+            static thread_local std::mt19937 gen{std::random_device{}()};
+            keep = BPSandbox::lowVarianceSample(lod.max_send, BPSandbox::normalizeVector(weights, true), gen);
+            keep.erase(std::unique(keep.begin(), keep.end()), keep.end());
+        }
+
+        auto selected = std::make_shared<BPSandbox::spider::SpiderList>();
+        for (auto& idx : keep) selected->push_back((*particles)[idx]);
+        msg.setParticles(selected);
+    }
+
+    /**
+     * Send the latest published results of the filter. This never touches
+     * the filter itself, so it is answered as soon as it is parsed, even
+     * while the compute stage runs updates for another connection. The level
+     * of detail options of the request only apply to this reply.
+     */
+    void sendLatest(std::shared_ptr<WsServer::Connection>& connection, const InMessageHelper& in_msg)
+    {
+        std::shared_ptr<const BPSandbox::FilterResults> results = pf.published();
+
+        LevelOfDetail lod;
+        readLevelOfDetail(in_msg, lod);
+
+        ParticleMessage msg;
+        if (results)
+        {
+            addResults(msg, lod, results);
+            msg.info["iteration"] = results->update_count;
+            msg.info["ess"] = results->ess;
+            msg.info["converged"] = results->converged ? 1 : 0;
+        }
+        addQueueInfo(connection, msg);
+        sendParticleMessage(connection, msg);
+    }
+
+    /**
+     * The first stage of the pipeline, run on the socket thread. The message
+     * is parsed here, then handed to the compute stage, which uses the
+     * filter one message at a time. Readers of the published results skip
+     * the compute stage.
+     */
+    void receive(std::shared_ptr<WsServer::Connection> connection, std::shared_ptr<WsServer::InMessage> in_message)
+    {
+        // The parsed message points into the text, so they travel together.
+        auto request = std::make_shared<Request>(in_message->string());
+
+        if (request->msg.isVal("action", "latest"))
+        {
+            sendLatest(connection, request->msg);
+            return;
+        }
+
+        compute_.post([this, connection, request]() mutable {
+            handleServerMessage(connection, request->msg);
         });
     }
 
-    void handleServerMessage(std::shared_ptr<WsServer::Connection>& connection, InMessageHelper& in_msg)
+    /**
+     * Queue a message for a connection. The message is serialized by the
+     * serialize stage, so the compute stage can start on the next message
+     * while this one is written.
+     */
+    void sendParticleMessage(std::shared_ptr<WsServer::Connection>& connection, const ParticleMessage& msg,
+                             const bool droppable = true)
+    {
+        auto owned = std::make_shared<ParticleMessage>(msg);
+        std::shared_ptr<WsServer::Connection> target = connection;
+        serialize_.post([this, target, owned, droppable]() {
+            queueMessage(target, *owned, droppable);
+        });
+    }
+
+    /**
+     * Add the send queue metrics of a connection to a message.
+     */
+    void addQueueInfo(std::shared_ptr<WsServer::Connection>& connection, ParticleMessage& msg)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        auto it = queues_.find(connection.get());
+        if (it != queues_.end())
+        {
+            const SendQueue& queue = it->second;
+            msg.info["queue_depth"] = queue.depth();
+            msg.info["queue_max_depth"] = queue.max_depth;
+            msg.info["frames_sent"] = queue.sent;
+            msg.info["frames_dropped"] = queue.dropped;
+        }
+        msg.info["compute_pending"] = compute_.pending();
+        msg.info["serialize_pending"] = serialize_.pending();
+    }
+
+    /**
+     * Start the send queue of a new connection. Messages for connections
+     * without a queue are dropped, since they have been closed.
+     */
+    void openConnection(std::shared_ptr<WsServer::Connection>& connection)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queues_[connection.get()] = SendQueue();
+    }
+
+    /**
+     * Forget the send queue of a closed connection.
+     */
+    void closeConnection(std::shared_ptr<WsServer::Connection>& connection)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queues_.erase(connection.get());
+    }
+
+    /**
+     * The compute stage. Runs one message against the filter, on the compute
+     * thread.
+     */
+    void handleServerMessage(std::shared_ptr<WsServer::Connection>& connection, const InMessageHelper& in_msg)
     {
         if (in_msg.hasKey("action"))
         {
-            if (in_msg.getVal("action") == "init")
+            if (in_msg.isVal("action", "init"))
             {
                 std::cout << "Server: Sending initialize message to " << connection.get() << std::endl;
                 // connection->send is an asynchronous function
                 int num_particles = 10;
-                if (in_msg.hasKey("num_particles")) num_particles = std::stoi(in_msg.getVal("num_particles"));
+                if (in_msg.hasKey("num_particles")) num_particles = in_msg.getInt("num_particles");
                 bool use_obs = true;
-                if (in_msg.hasKey("init_informed")) use_obs = std::stoi(in_msg.getVal("init_informed")) == 1;
+                if (in_msg.hasKey("init_informed")) use_obs = in_msg.getBool("init_informed");
+
+                if (in_msg.hasKey("observations"))
+                {
+                    // Views of the same scene, as [{"image": ..., "data": ...}, ...],
+                    // named by files in the data directory.
+                    std::vector<BPSandbox::Observation> views;
+                    bool ok = true;
+                    in_msg.get("observations").forEach([this, &views, &ok](const JsonView& view) {
+                        std::string image, data;
+                        if (!dataPath(view.get("image").asString(), image) ||
+                            !dataPath(view.get("data").asString(), data))
+                        {
+                            ok = false;
+                            return;
+                        }
+
+                        views.push_back(BPSandbox::Observation(image, data));
+                        if (views.back().empty()) ok = false;
+                    });
+
+                    if (ok && views.size() > 0) pf.setObservations(views);
+                    else std::cout << "Could not load the observations, keeping the current ones." << std::endl;
+                }
+
+                bool coarse_to_fine = true;
+                int coarse_level = 2;
+                double coarse_cutoff = 10;
+                if (in_msg.hasKey("coarse_to_fine")) coarse_to_fine = in_msg.getBool("coarse_to_fine");
+                if (in_msg.hasKey("coarse_level")) coarse_level = in_msg.getInt("coarse_level");
+                if (in_msg.hasKey("coarse_cutoff")) coarse_cutoff = in_msg.getDouble("coarse_cutoff");
+                pf.setCoarseToFine(coarse_to_fine, coarse_level, coarse_cutoff);
+                if (in_msg.hasKey("likelihood"))
+                {
+                    BPSandbox::LikelihoodType likelihood;
+                    if (BPSandbox::parseLikelihood(in_msg.getVal("likelihood"), likelihood))
+                    {
+                        pf.setLikelihood(likelihood);
+                    }
+                    else
+                    {
+                        std::cout << "Likelihood " << in_msg.getVal("likelihood") << " is unknown." << std::endl;
+                    }
+                }
+                if (in_msg.hasKey("proposal_rate")) pf.setProposalRate(in_msg.getDouble("proposal_rate"));
+                if (in_msg.hasKey("jitter_scale"))
+                {
+                    // Scales the default jitter of 2 pixels, 0.1 radians and 2 pixels.
+                    float scale = in_msg.getDouble("jitter_scale");
+                    pf.setJitter(2 * scale, 0.1 * scale, 2 * scale);
+                }
 
+                bool anneal = false;
+                double anneal_beta0 = 0.1, anneal_beta_rate = 1.5;
+                double anneal_jitter_decay = 0.8, anneal_min_jitter = 0.1;
+                if (in_msg.hasKey("anneal")) anneal = in_msg.getBool("anneal");
+                if (in_msg.hasKey("anneal_beta0")) anneal_beta0 = in_msg.getDouble("anneal_beta0");
+                if (in_msg.hasKey("anneal_beta_rate")) anneal_beta_rate = in_msg.getDouble("anneal_beta_rate");
+                if (in_msg.hasKey("anneal_jitter_decay")) anneal_jitter_decay = in_msg.getDouble("anneal_jitter_decay");
+                if (in_msg.hasKey("anneal_min_jitter")) anneal_min_jitter = in_msg.getDouble("anneal_min_jitter");
+                pf.setAnnealing(anneal, anneal_beta0, anneal_beta_rate, anneal_jitter_decay, anneal_min_jitter);
+
+                bool mcmc = false;
+                int mcmc_moves = 8;
+                double mcmc_angle = 0.2;
+                if (in_msg.hasKey("mcmc")) mcmc = in_msg.getBool("mcmc");
+                if (in_msg.hasKey("mcmc_moves")) mcmc_moves = in_msg.getInt("mcmc_moves");
+                if (in_msg.hasKey("mcmc_angle")) mcmc_angle = in_msg.getDouble("mcmc_angle");
+                pf.setResampleMove(mcmc, std::max(0, mcmc_moves), mcmc_angle);
+
+                bool factored = false;
+                int leg_candidates = 4;
+                if (in_msg.hasKey("factored")) factored = in_msg.getBool("factored");
+                if (in_msg.hasKey("leg_candidates")) leg_candidates = in_msg.getInt("leg_candidates");
+                pf.setFactored(factored, std::max(1, leg_candidates));
+
+                bool adaptive = false;
+                int min_particles = 10, max_particles = 1000;
+                double kld_epsilon = 0.05;
+                if (in_msg.hasKey("adaptive")) adaptive = in_msg.getBool("adaptive");
+                if (in_msg.hasKey("min_particles")) min_particles = in_msg.getInt("min_particles");
+                if (in_msg.hasKey("max_particles")) max_particles = in_msg.getInt("max_particles");
+                if (in_msg.hasKey("kld_epsilon")) kld_epsilon = in_msg.getDouble("kld_epsilon");
+                pf.setAdaptive(adaptive, min_particles, max_particles, kld_epsilon);
+
+                bool detect_convergence = true;
+                double convergence_pix = 0.5, convergence_w = 0.1;
+                int patience = 5;
+                if (in_msg.hasKey("resample_ess")) pf.setResampleThreshold(in_msg.getDouble("resample_ess"));
+                if (in_msg.hasKey("early_stop")) detect_convergence = in_msg.getBool("early_stop");
+                if (in_msg.hasKey("convergence_pix")) convergence_pix = in_msg.getDouble("convergence_pix");
+                if (in_msg.hasKey("convergence_w")) convergence_w = in_msg.getDouble("convergence_w");
+                if (in_msg.hasKey("patience")) patience = in_msg.getInt("patience");
+                pf.setConvergence(detect_convergence, convergence_pix, convergence_w, patience);
+
+                if (in_msg.hasKey("checkpoint_every"))
+                {
+                    std::string path;
+                    if (snapshotPath(in_msg, "checkpoint_path", path)) pf.setCheckpoint(path, in_msg.getInt("checkpoint_every"));
+                    else std::cout << "Checkpoint name is not allowed, not checkpointing." << std::endl;
+                }
+
+                bool multi_target = false;
+                if (in_msg.hasKey("multi_target")) multi_target = in_msg.getBool("multi_target");
+
+                if (multi_target) pf.initTargets(num_particles);
+                else              pf.init(num_particles, use_obs);
+
+                setLevelOfDetail(in_msg);
                 ParticleMessage msg;
-                msg.setParticles(pf.init(num_particles, use_obs));
+                setParticlesLOD(msg);
 
                 sendParticleMessage(connection, msg);
             }
-            else if (in_msg.getVal("action") == "update")
+            else if (in_msg.isVal("action", "update"))
             {
                 std::cout << "Running one update" << std::endl;
 
+                pf.update();
+
+                setLevelOfDetail(in_msg);
                 ParticleMessage msg;
-                msg.setParticles(pf.update());
+                setParticlesLOD(msg);
+                msg.info["iteration"] = pf.updateCount();
+                msg.info["ess"] = pf.effectiveSampleSize();
+                msg.info["converged"] = pf.converged() ? 1 : 0;
+                msg.info["temperature"] = pf.temperature();
+                msg.info["jitter_scale"] = pf.jitterScale();
+                msg.info["move_acceptance"] = pf.moveAcceptance();
+                msg.info["likelihood_cost_us"] = pf.likelihoodCost();
+                msg.info["pose_error"] = pf.poseError();
+                addQueueInfo(connection, msg);
                 sendParticleMessage(connection, msg);
 
                 std::cout << "Done" << std::endl;
             }
-            else if (in_msg.getVal("action") == "estimate")
+            else if (in_msg.isVal("action", "estimate"))
             {
                 std::cout << "Running one update" << std::endl;
 
                 ParticleMessage msg;
-                msg.setParticles(pf.estimate());
-                sendParticleMessage(connection, msg);
+                msg.setParticles(std::make_shared<BPSandbox::spider::SpiderList>(pf.estimate()));
+                sendParticleMessage(connection, msg, false);
+
+                std::cout << "Done" << std::endl;
+            }
+            else if (in_msg.isVal("action", "estimate_all"))
+            {
+                std::cout << "Estimating all targets" << std::endl;
+
+                double min_likelihood = -40;
+                if (in_msg.hasKey("min_likelihood")) min_likelihood = in_msg.getDouble("min_likelihood");
+
+                ParticleMessage msg;
+                msg.setParticles(std::make_shared<BPSandbox::spider::SpiderList>(pf.estimateAll(min_likelihood)));
+                sendParticleMessage(connection, msg, false);
 
                 std::cout << "Done" << std::endl;
             }
+            else if (in_msg.isVal("action", "save"))
+            {
+                std::string path;
+                bool saved = false;
+                if (snapshotPath(in_msg, "path", path))
+                {
+                    std::cout << "Saving snapshot to " << path << std::endl;
+                    saved = pf.saveSnapshotAsync(path);
+                }
+                else
+                {
+                    std::cout << "Snapshot name is not allowed." << std::endl;
+                }
+
+                ParticleMessage msg;
+                msg.info["saved"] = saved ? 1 : 0;
+                sendParticleMessage(connection, msg, false);
+            }
+            else if (in_msg.isVal("action", "load"))
+            {
+                std::string path;
+                bool loaded = false;
+                if (snapshotPath(in_msg, "path", path))
+                {
+                    std::cout << "Loading snapshot from " << path << std::endl;
+                    loaded = pf.loadSnapshot(path);
+                }
+                else
+                {
+                    std::cout << "Snapshot name is not allowed." << std::endl;
+                }
+
+                ParticleMessage msg;
+                if (loaded) setParticlesLOD(msg);
+                msg.info["loaded"] = loaded ? 1 : 0;
+                msg.info["iteration"] = pf.updateCount();
+                sendParticleMessage(connection, msg, false);
+            }
+            else if (in_msg.isVal("action", "likelihoods"))
+            {
+                std::cout << "Profiling likelihoods" << std::endl;
+
+                // Cost and accuracy of each likelihood on the current particles.
+                ParticleMessage msg;
+                for (auto& report : pf.profileLikelihoods())
+                {
+                    std::string name = BPSandbox::likelihoodName(report.type);
+                    msg.info[name + "_cost_us"] = report.cost_us;
+                    msg.info[name + "_pose_error"] = report.pose_error;
+                    msg.info[name + "_gt_margin"] = report.gt_margin;
+                }
+                sendParticleMessage(connection, msg, false);
+            }
+            else if (in_msg.isVal("action", "stats"))
+            {
+                ParticleMessage msg;
+                addQueueInfo(connection, msg);
+                sendParticleMessage(connection, msg, false);
+            }
             else
             {
                 std::cout << "Action " << in_msg.getVal("action") << "is unknown." << std::endl;
@@ -79,11 +473,193 @@ public:
             std::cout << "Nothing to do." << std::endl;
         }
     }
+
+private:
+    /**
+     * A received message and its parsed form, which points into the text.
+     */
+    struct Request
+    {
+        Request(const std::string& in_text) :
+          text(in_text),
+          msg(text)
+        {
+        }
+
+        const std::string text;
+        const InMessageHelper msg;
+    };
+
+    /**
+     * Whether a file name sent by a client names a file directly in a
+     * directory of the server, without any path components.
+     */
+    static bool isPlainName(const std::string& name)
+    {
+        return !name.empty() && name != "." && name.find("..") == std::string::npos &&
+               name.find_first_of("/\\") == std::string::npos;
+    }
+
+    /**
+     * The path of a snapshot named by a client, under the snapshot directory
+     * of the server. Clients only name snapshots, so names with directories
+     * are refused and nothing outside the directory is read or written.
+     * @param in_msg The message.
+     * @param key    The key of the name. Defaults to "bp_filter.snapshot".
+     * @param path   Set to the path of the snapshot.
+     * @return       False if the name is not allowed.
+     */
+    bool snapshotPath(const InMessageHelper& in_msg, const std::string& key, std::string& path) const
+    {
+        std::string name = "bp_filter.snapshot";
+        if (in_msg.hasKey(key)) name = in_msg.getVal(key);
+
+        if (!isPlainName(name)) return false;
+
+        path = snapshot_dir_ + "/" + name;
+        return true;
+    }
+
+    /**
+     * The path of an observation file named by a client, under the data
+     * directory of the server.
+     * @param name The file name.
+     * @param path Set to the path of the file.
+     * @return     False if the name is not allowed.
+     */
+    bool dataPath(const std::string& name, std::string& path) const
+    {
+        if (!isPlainName(name)) return false;
+
+        path = data_dir_ + "/" + name;
+        return true;
+    }
+
+    /**
+     * Serialize a message and queue it for a connection. At most max_in_flight messages are
+     * handed to the socket at once. Past that, a droppable message replaces
+     * the droppable message already waiting, since only the latest particles
+     * are worth drawing, while other messages wait their turn.
+     */
+    void queueMessage(std::shared_ptr<WsServer::Connection> connection, const ParticleMessage& msg,
+                      const bool droppable)
+    {
+        // Serialize straight into the send buffer.
+        auto out_message = std::make_shared<WsServer::OutMessage>(msg.sizeHint());
+        msg.writeJSON(*out_message);
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            // The connection may have closed while the message was computed.
+            auto it = queues_.find(connection.get());
+            if (it == queues_.end()) return;
+
+            SendQueue& queue = it->second;
+            if (queue.in_flight >= max_in_flight_)
+            {
+                if (!droppable)
+                {
+                    queue.required.push_back(out_message);
+                }
+                else
+                {
+                    if (queue.latest) queue.dropped++;
+                    queue.latest = out_message;
+                }
+                queue.max_depth = std::max(queue.max_depth, queue.depth());
+                return;
+            }
+
+            queue.in_flight++;
+            queue.max_depth = std::max(queue.max_depth, queue.depth());
+        }
+
+        sendQueued(connection, out_message);
+    }
+
+    /**
+     * Messages waiting for a connection.
+     */
+    struct SendQueue
+    {
+        SendQueue() :
+          in_flight(0),
+          sent(0),
+          dropped(0),
+          max_depth(0)
+        {
+        }
+
+        size_t depth() const
+        {
+            return in_flight + required.size() + (latest ? 1 : 0);
+        }
+
+        size_t in_flight;
+        std::deque<std::shared_ptr<WsServer::OutMessage> > required;
+        std::shared_ptr<WsServer::OutMessage> latest;
+        size_t sent, dropped, max_depth;
+    };
+
+    void sendQueued(std::shared_ptr<WsServer::Connection> connection,
+                    std::shared_ptr<WsServer::OutMessage> out_message)
+    {
+        connection->send(out_message, [this, connection](const SimpleWeb::error_code &ec) {
+            if(ec) {
+                std::cout << "Server: Error sending message. " <<
+                    // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
+                    "Error: " << ec << ", error message: " << ec.message() << std::endl;
+            }
+
+            // Send whatever was waiting for this message to go out.
+            std::shared_ptr<WsServer::OutMessage> next;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                auto it = queues_.find(connection.get());
+                if (it == queues_.end()) return;
+
+                SendQueue& queue = it->second;
+                queue.in_flight--;
+                if (!ec) queue.sent++;
+
+                if (!queue.required.empty())
+                {
+                    next = queue.required.front();
+                    queue.required.pop_front();
+                }
+                else if (queue.latest)
+                {
+                    next = queue.latest;
+                    queue.latest.reset();
+                }
+                if (next) queue.in_flight++;
+            }
+
+            if (next) sendQueued(connection, next);
+        });
+    }
+
+    std::mutex queue_mutex_;
+    std::map<WsServer::Connection*, SendQueue> queues_;
+    size_t max_in_flight_;
+    // Clients can only load observations from here.
+    const std::string data_dir_;
+    // Snapshots are only read and written here.
+    const std::string snapshot_dir_;
+
+    LevelOfDetail lod_;
+
+    // The pipeline stages after parsing. They are declared last so they stop
+    // first, and the compute stage stops before the stage it feeds.
+    WorkQueue serialize_;
+    WorkQueue compute_;
 };
 
 
 int main() {
-  // WebSocket (WS)-server at port 8080 using 1 thread
+  // WebSocket (WS)-server at port 8080 using 1 thread. Inference and
+  // serialization run on the stages of the helper, so this thread only
+  // parses and sends.
   WsServer server;
   server.config.port = 8080;
   std::shared_ptr<ServerHelper> helper = std::make_shared<ServerHelper>();
@@ -92,22 +668,21 @@ int main() {
   auto &bp_socket = server.endpoint["^/bp/?$"];
 
   bp_socket.on_message = [&, helper](std::shared_ptr<WsServer::Connection> connection, std::shared_ptr<WsServer::InMessage> in_message) {
-    auto string_msg = in_message->string();
-
-    std::cout << "Server: Message received: \"" << string_msg << "\" from " << connection.get() << std::endl;
-    InMessageHelper in_msg(string_msg);
+    std::cout << "Server: Message received (" << in_message->size() << " bytes) from " << connection.get() << std::endl;
 
-    helper->handleServerMessage(connection, in_msg);
+    helper->receive(connection, in_message);
   };
 
   // Setup some basic functions.
-  bp_socket.on_open = [](std::shared_ptr<WsServer::Connection> connection) {
+  bp_socket.on_open = [helper](std::shared_ptr<WsServer::Connection> connection) {
     std::cout << "Server: Opened connection " << connection.get() << std::endl;
+    helper->openConnection(connection);
   };
 
   // See RFC 6455 7.4.1. for status codes
-  bp_socket.on_close = [](std::shared_ptr<WsServer::Connection> connection, int status, const std::string & /*reason*/) {
+  bp_socket.on_close = [helper](std::shared_ptr<WsServer::Connection> connection, int status, const std::string & /*reason*/) {
     std::cout << "Server: Closed connection " << connection.get() << " with status code " << status << std::endl;
+    helper->closeConnection(connection);
   };
 
   // Can modify handshake response headers here if needed
@@ -116,9 +691,10 @@ int main() {
   };
 
   // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-  bp_socket.on_error = [](std::shared_ptr<WsServer::Connection> connection, const SimpleWeb::error_code &ec) {
+  bp_socket.on_error = [helper](std::shared_ptr<WsServer::Connection> connection, const SimpleWeb::error_code &ec) {
     std::cout << "Server: Error in connection " << connection.get() << ". "
          << "Error: " << ec << ", error message: " << ec.message() << std::endl;
+    helper->closeConnection(connection);
   };
 
   // Start server and receive assigned port when server is listening for requests
@@ -5,96 +5,190 @@
 #include <future>
 #include <random>
 #include <algorithm>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
 
 #include <simple-websocket-server/client_ws.hpp>
 #include <simple-websocket-server/server_ws.hpp>
 
+#include "json_view.h"
+#include "json_writer.h"
+#include "inference/common/spider_particle.h"
+
 using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
 using WsClient = SimpleWeb::SocketClient<SimpleWeb::WS>;
 
 typedef std::vector<std::vector<float> > ParticleList;
 
 
+/**
+ * Parses an incoming command in one pass over the message, without copying
+ * it. The message must outlive the helper.
+ */
 class InMessageHelper
 {
 public:
-    InMessageHelper(const std::string& in_msg)
+    InMessageHelper(const std::string& in_msg) :
+      num_members_(0)
     {
-        parseInput(in_msg);
+        parseInput(in_msg.data(), in_msg.data() + in_msg.size());
     }
 
-    std::map<std::string, std::string> getData() const
+    InMessageHelper(const char* begin, const char* end) :
+      num_members_(0)
     {
-        return data_;
+        parseInput(begin, end);
     }
 
-    bool hasKey(const std::string k) const
+    bool hasKey(const std::string& k) const
     {
-        return (data_.find(k) != data_.end());
+        return get(k).valid();
+    }
+
+    /**
+     * Get a top level value, or an invalid view if there is no such key.
+     */
+    JsonView get(const std::string& k) const
+    {
+        for (size_t i = 0; i < num_members_; ++i)
+        {
+            if (keys_[i].equals(k.c_str(), k.size())) return values_[i];
+        }
+        return JsonView();
     }
 
+    /**
+     * Get a value as text. Strings are returned without quotes.
+     */
     std::string getVal(const std::string& k) const
     {
-        std::string val = data_.at(k);
-        return val;
+        return get(k).asString();
+    }
+
+    int getInt(const std::string& k, const int default_val = 0) const
+    {
+        return get(k).asInt(default_val);
+    }
+
+    double getDouble(const std::string& k, const double default_val = 0) const
+    {
+        return get(k).asDouble(default_val);
+    }
+
+    bool getBool(const std::string& k, const bool default_val = false) const
+    {
+        return get(k).asBool(default_val);
+    }
+
+    /**
+     * Check a string value without copying it.
+     */
+    bool isVal(const std::string& k, const char* val) const
+    {
+        return get(k).equals(val);
     }
 
 private:
-    void parseInput(const std::string& in_msg)
+    // Commands only have a handful of top level keys. Later keys are ignored.
+    static const size_t MAX_MEMBERS = 64;
+
+    void parseInput(const char* begin, const char* end)
     {
-        std::cout << "Parsing incoming message..." << std::endl;
-        std::string raw = in_msg;
+        JsonView msg(begin, end);
 
-        if (raw.find("{") == std::string::npos)
+        if (!msg.isObject())
         {
-            std::cout << "Incoming message is not valid: " << raw << std::endl;
+            std::cout << "Incoming message is not valid: "
+                      << std::string(begin, std::min<size_t>(end - begin, 100)) << std::endl;
             return;
         }
 
-        // Remove first bracket.
-        raw.erase(0, raw.find("{") + 1);
-        while (raw.find(":") != std::string::npos)
-        {
-            std::string key = raw.substr(0, raw.find(":"));
-            key = strip(key);
-            raw.erase(0, raw.find(":") + 1);
+        // Index the top level members, so lookups don't scan large values.
+        msg.forEachMember([this](const JsonView& key, const JsonView& value) {
+            if (num_members_ >= MAX_MEMBERS) return;
+            keys_[num_members_] = key;
+            values_[num_members_] = value;
+            num_members_++;
+        });
+    }
 
-            data_.insert({key, ""});
+    JsonView keys_[MAX_MEMBERS];
+    JsonView values_[MAX_MEMBERS];
+    size_t num_members_;
+};
 
-            std::string val;
-            if (raw.find(",") != std::string::npos)
-            {
-                val = raw.substr(0, raw.find(","));
-                val = strip(val);
-                data_[key] = val;
-                raw.erase(0, raw.find(",") + 1);
-            }
-            else
-            {
-                val = raw.substr(0, raw.find("}"));
-                val = strip(val);
-                data_[key] = val;
-                break;
-            }
+
+/**
+ * Runs tasks in order on a thread of its own. Each stage of the server
+ * pipeline has one, so a stage can start on the next message while the later
+ * stages finish the previous one. Tasks left when the queue is destroyed are
+ * run first.
+ */
+class WorkQueue
+{
+public:
+    WorkQueue() :
+      stop_(false),
+      worker_([this]() { run(); })
+    {
+    }
+
+    ~WorkQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
         }
-        std::cout << "Data:" << std::endl;
-        for (auto const& x : data_)
+        ready_.notify_one();
+        worker_.join();
+    }
+
+    void post(const std::function<void()>& task)
+    {
         {
-            std::cout << "\t" << x.first << ": " << x.second << std::endl;
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(task);
         }
-        std::cout << std::endl;
+        ready_.notify_one();
     }
-    std::string strip(const std::string& s)
+
+    /**
+     * The number of tasks waiting, not counting the one running.
+     */
+    size_t pending() const
     {
-        std::string r = s;
-        r.erase(std::remove(r.begin(), r.end(), '\"'), r.end());
-        r.erase(std::remove(r.begin(), r.end(), '\''), r.end());
-        r.erase(std::remove(r.begin(), r.end(), ' '), r.end());
-        return r;
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tasks_.size();
     }
 
-    std::map<std::string, std::string> data_;
+private:
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+
+                task = tasks_.front();
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
 
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()> > tasks_;
+    bool stop_;
+    // Started last, once the rest of the queue is ready.
+    std::thread worker_;
 };
 
 
@@ -106,33 +200,60 @@ public:
     {
     }
 
-    std::string toJSONString() const
+    /**
+     * Write the message as JSON straight into a stream.
+     */
+    void writeJSON(std::ostream& out) const
     {
-        std::string msg = "{";
+        JsonWriter writer(out);
+        writer.beginObject();
         // Algo info.
-        msg += "\"algo\": \"" + algo + "\",";
+        writer.key("algo");
+        writer.value(algo);
+        // Run info.
+        for (auto const& x : info)
+        {
+            writer.key(x.first);
+            writer.value(x.second);
+        }
         // Particles:
         for (auto const& x : particles)
         {
-            msg += "\"" + x.first + "\": [";
-            // Add each particle.
-            for (auto& p : x.second)
-            {
-                msg += "[";
-                for (auto& ele : p)
-                {
-                    msg += std::to_string(ele) + ",";
-                }
-                msg.pop_back();
-                msg += "],";
-            }
-            msg.pop_back();
-            msg += "],";
+            writer.key(x.first);
+            writer.beginArray();
+            for (auto& p : x.second) writer.array(p);
+            writer.endArray();
         }
-        msg.pop_back();
-        msg += "}";
+        if (spiders_ != nullptr && spiders_->size() > 0) writeSpiders(writer, *spiders_);
+        if (estimate_ != nullptr && estimate_->size() > 0)
+        {
+            writer.key("estimate");
+            writer.beginObject();
+            writeSpiders(writer, *estimate_);
+            writer.endObject();
+        }
+        writer.endObject();
+    }
+
+    std::string toJSONString() const
+    {
+        std::ostringstream ss;
+        writeJSON(ss);
+        return ss.str();
+    }
 
-        return msg;
+    /**
+     * Rough upper bound on the size of the JSON, to reserve space once.
+     */
+    size_t sizeHint() const
+    {
+        // Each spider has a circle and eight rectangles of at most five
+        // numbers with three decimals.
+        size_t size = 256 + info.size() * 32;
+        if (spiders_ != nullptr) size += spiders_->size() * 9 * 5 * 12;
+        if (estimate_ != nullptr) size += estimate_->size() * 9 * 5 * 12;
+        for (auto const& x : particles) size += x.second.size() * 5 * 12;
+        return size;
     }
 
     void setParticles(const std::map<std::string, ParticleList>& p)
@@ -140,8 +261,68 @@ public:
         particles = p;
     }
 
+    /**
+     * Set the particles from spiders. The message shares them rather than
+     * copying them, so it can be written on another thread while the filter
+     * moves on.
+     */
+    void setParticles(const std::shared_ptr<const BPSandbox::spider::SpiderList>& p)
+    {
+        spiders_ = p;
+    }
+
+    /**
+     * Set the current estimate, sent alongside the particles. It is shared
+     * too.
+     */
+    void setEstimate(const std::shared_ptr<const BPSandbox::spider::SpiderList>& est)
+    {
+        estimate_ = est;
+    }
+
     std::string algo;
+    std::map<std::string, double> info;
     std::map<std::string, ParticleList> particles;
+
+private:
+    std::shared_ptr<const BPSandbox::spider::SpiderList> spiders_;
+    std::shared_ptr<const BPSandbox::spider::SpiderList> estimate_;
+
+    /**
+     * Write the spiders part by part, with the same layout as particlesToMap().
+     */
+    static void writeSpiders(JsonWriter& writer, const BPSandbox::spider::SpiderList& spiders)
+    {
+        writer.key("circles");
+        writer.beginArray();
+        for (auto& s : spiders)
+        {
+            writer.beginArray();
+            writer.value(s.x);
+            writer.value(s.y);
+            writer.value(s.root.radius);
+            writer.endArray();
+        }
+        writer.endArray();
+
+        for (size_t i = 0; i < spiders[0].links.size(); ++i)
+        {
+            writer.key("l" + std::to_string(i + 1));
+            writer.beginArray();
+            for (auto& s : spiders)
+            {
+                const BPSandbox::spider::Rectangle& l = s.links[i];
+                writer.beginArray();
+                writer.value(l.x);
+                writer.value(l.y);
+                writer.value(l.theta);
+                writer.value(l.width);
+                writer.value(l.height);
+                writer.endArray();
+            }
+            writer.endArray();
+        }
+    }
 };
 
 
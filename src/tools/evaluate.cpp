@@ -0,0 +1,324 @@
+// Runs the particle filter over scenes with ground truth for a grid of
+// configurations, and reports accuracy against cost as a Pareto table.
+//
+// Usage: bp_evaluate [--scene IMAGE DATA]... [--generated DIR COUNT]
+//          [--particles 50,100,200] [--likelihoods sdf,chamfer]
+//          [--jitter 0.5,1,2] [--runs 3] [--max_iters 60] [--anneal] [--mcmc]
+//          [--factored] [--csv FILE] [--max_error PIX]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "../inference/particle_filter.h"
+#include "../inference/common/inference_utils.h"
+
+using namespace BPSandbox;
+
+namespace
+{
+
+// A run counts as a success if its pose error is below this, in pixels.
+const double SUCCESS_PIX = 5;
+
+struct Options
+{
+  std::vector<std::pair<std::string, std::string> > scenes;
+  std::vector<int> particles = {50, 100, 200};
+  std::vector<LikelihoodType> likelihoods = {LikelihoodType::SDF, LikelihoodType::CHAMFER};
+  std::vector<double> jitter = {0.5, 1, 2};
+  int runs = 3;
+  int max_iters = 60;
+  bool anneal = false;
+  bool mcmc = false;
+  bool factored = false;
+  std::string csv;
+  // Fail if any configuration's mean pose error is above this, if positive.
+  double max_error = 0;
+};
+
+struct Config
+{
+  int num_particles;
+  LikelihoodType likelihood;
+  double jitter_scale;
+};
+
+/**
+ * Results of a configuration, averaged over scenes and runs.
+ */
+struct Result
+{
+  Config config;
+  double pose_error;
+  double success_rate;
+  double iterations;
+  double converged_rate;
+  double seconds;
+  bool pareto;
+};
+
+void usage()
+{
+  std::cerr << "Usage: bp_evaluate [--scene IMAGE DATA]... [--generated DIR COUNT]\n"
+            << "         [--particles 50,100,200] [--likelihoods sdf,chamfer] [--jitter 0.5,1,2]\n"
+            << "         [--runs 3] [--max_iters 60] [--anneal] [--mcmc] [--factored]\n"
+            << "         [--csv FILE] [--max_error PIX]\n"
+            << "  --scene      An image and its data file with a GT section. Can be repeated.\n"
+            << "  --generated  COUNT frames written by bp_make_observation --frames into DIR.\n"
+            << "  --jitter     Scales of the default particle jitter.\n"
+            << "  --anneal     Run the filter with the default annealing schedule.\n"
+            << "  --mcmc       Move the particles with Metropolis-Hastings steps after resampling.\n"
+            << "  --factored   Propose the root and each leg separately.\n"
+            << "  --max_error  Exit with an error if a mean pose error is above this, in pixels.\n";
+}
+
+template <class T>
+bool parseList(const std::string& arg, std::vector<T>& vals)
+{
+  vals.clear();
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    std::stringstream is(item);
+    T val;
+    if (!(is >> val)) return false;
+    vals.push_back(val);
+  }
+  return vals.size() > 0;
+}
+
+bool parseArgs(int argc, char** argv, Options& opts)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--anneal")
+    {
+      opts.anneal = true;
+    }
+    else if (arg == "--mcmc")
+    {
+      opts.mcmc = true;
+    }
+    else if (arg == "--factored")
+    {
+      opts.factored = true;
+    }
+    else if (arg == "--scene" && i + 2 < argc)
+    {
+      opts.scenes.push_back({argv[i + 1], argv[i + 2]});
+      i += 2;
+    }
+    else if (arg == "--generated" && i + 2 < argc)
+    {
+      std::string dir = argv[i + 1];
+      int count = atoi(argv[i + 2]);
+      for (int f = 0; f < count; ++f)
+      {
+        char num[16];
+        snprintf(num, sizeof(num), "_%04d", f);
+        opts.scenes.push_back({dir + "/obs" + num + ".pbm", dir + "/obs_data" + num + ".txt"});
+      }
+      i += 2;
+    }
+    else if (i + 1 >= argc)
+    {
+      return false;
+    }
+    else if (arg == "--particles")
+    {
+      if (!parseList(argv[++i], opts.particles)) return false;
+    }
+    else if (arg == "--jitter")
+    {
+      if (!parseList(argv[++i], opts.jitter)) return false;
+    }
+    else if (arg == "--likelihoods")
+    {
+      std::vector<std::string> names;
+      if (!parseList(argv[++i], names)) return false;
+
+      opts.likelihoods.clear();
+      for (auto& name : names)
+      {
+        LikelihoodType type;
+        if (!parseLikelihood(name, type))
+        {
+          std::cerr << "Likelihood " << name << " is unknown." << std::endl;
+          return false;
+        }
+        opts.likelihoods.push_back(type);
+      }
+    }
+    else if (arg == "--runs") opts.runs = std::max(1, atoi(argv[++i]));
+    else if (arg == "--max_iters") opts.max_iters = std::max(1, atoi(argv[++i]));
+    else if (arg == "--csv") opts.csv = argv[++i];
+    else if (arg == "--max_error") opts.max_error = atof(argv[++i]);
+    else return false;
+  }
+
+  if (opts.scenes.empty()) opts.scenes.push_back({"data/obs.pbm", "data/obs_data.txt"});
+  return true;
+}
+
+/**
+ * Mark the results which no other result beats on both pose error and time.
+ */
+void markPareto(std::vector<Result>& results)
+{
+  for (auto& r : results)
+  {
+    r.pareto = true;
+    for (auto& other : results)
+    {
+      bool no_worse = other.pose_error <= r.pose_error && other.seconds <= r.seconds;
+      bool better = other.pose_error < r.pose_error || other.seconds < r.seconds;
+      if (no_worse && better)
+      {
+        r.pareto = false;
+        break;
+      }
+    }
+  }
+}
+
+void printTable(std::ostream& out, const std::vector<Result>& results)
+{
+  char line[256];
+  snprintf(line, sizeof(line), "%-8s %10s %7s %10s %8s %8s %9s %10s %7s\n", "pareto", "likelihood",
+           "jitter", "particles", "error", "success", "iters", "converged", "time");
+  out << line;
+
+  for (auto& r : results)
+  {
+    snprintf(line, sizeof(line), "%-8s %10s %7.2f %10d %8.2f %7.0f%% %9.1f %9.0f%% %6.3fs\n",
+             r.pareto ? "*" : "", likelihoodName(r.config.likelihood), r.config.jitter_scale,
+             r.config.num_particles, r.pose_error, 100 * r.success_rate, r.iterations,
+             100 * r.converged_rate, r.seconds);
+    out << line;
+  }
+}
+
+void writeCsv(const std::string& path, const std::vector<Result>& results)
+{
+  std::ofstream out(path);
+  out << "likelihood,jitter,particles,pose_error,success_rate,iterations,converged_rate,seconds,pareto\n";
+  for (auto& r : results)
+  {
+    out << likelihoodName(r.config.likelihood) << "," << r.config.jitter_scale << ","
+        << r.config.num_particles << "," << r.pose_error << "," << r.success_rate << ","
+        << r.iterations << "," << r.converged_rate << "," << r.seconds << ","
+        << (r.pareto ? 1 : 0) << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  Options opts;
+  if (!parseArgs(argc, argv, opts))
+  {
+    usage();
+    return 1;
+  }
+
+  // Load the scenes once, keeping those with a ground truth.
+  std::vector<Observation> scenes;
+  std::vector<spider::SpiderParticle> truths;
+  for (auto& paths : opts.scenes)
+  {
+    Observation obs(paths.first, paths.second);
+    spider::SpiderList gt = groundTruth(obs);
+    if (obs.empty() || gt.empty())
+    {
+      std::cerr << "Skipping " << paths.first << ", it has no ground truth." << std::endl;
+      continue;
+    }
+
+    scenes.push_back(obs);
+    truths.push_back(gt[0]);
+  }
+
+  if (scenes.empty())
+  {
+    std::cerr << "No scenes to evaluate." << std::endl;
+    return 1;
+  }
+
+  std::vector<Result> results;
+  for (auto& likelihood : opts.likelihoods)
+  {
+    for (auto& jitter : opts.jitter)
+    {
+      for (auto& num_particles : opts.particles)
+      {
+        Result result = {{num_particles, likelihood, jitter}, 0, 0, 0, 0, 0, false};
+        const int num_runs = opts.runs * scenes.size();
+
+        for (size_t s = 0; s < scenes.size(); ++s)
+        {
+          for (int run = 0; run < opts.runs; ++run)
+          {
+            ParticleFilter pf;
+            pf.setObservations({scenes[s]});
+            pf.setLikelihood(likelihood);
+            pf.setJitter(2 * jitter, 0.1 * jitter, 2 * jitter);
+            pf.setAnnealing(opts.anneal);
+            pf.setResampleMove(opts.mcmc);
+            pf.setFactored(opts.factored);
+
+            auto start = std::chrono::steady_clock::now();
+            pf.init(num_particles);
+            while (!pf.converged() && pf.updateCount() < opts.max_iters) pf.update();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            double error = poseError(pf.estimate()[0], truths[s]);
+            result.pose_error += error / num_runs;
+            result.success_rate += (error < SUCCESS_PIX ? 1.0 : 0.0) / num_runs;
+            result.iterations += static_cast<double>(pf.updateCount()) / num_runs;
+            result.converged_rate += (pf.converged() ? 1.0 : 0.0) / num_runs;
+            result.seconds += elapsed.count() / num_runs;
+          }
+        }
+
+        results.push_back(result);
+        std::cerr << "Evaluated " << likelihoodName(likelihood) << ", jitter " << jitter
+                  << ", " << num_particles << " particles." << std::endl;
+      }
+    }
+  }
+
+  markPareto(results);
+  std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+    return a.seconds < b.seconds;
+  });
+
+  std::cout << "\n" << scenes.size() << " scenes, " << opts.runs << " runs each, at most "
+            << opts.max_iters << " updates. Times are per run.\n\n";
+  printTable(std::cout, results);
+
+  if (!opts.csv.empty()) writeCsv(opts.csv, results);
+
+  if (opts.max_error > 0)
+  {
+    for (auto& r : results)
+    {
+      if (r.pose_error > opts.max_error)
+      {
+        std::cerr << "Mean pose error " << r.pose_error << " is above " << opts.max_error << "." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
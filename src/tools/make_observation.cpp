@@ -0,0 +1,391 @@
+// Renders synthetic spider scenes, like scripts/make_observation.py but at
+// any size and fast enough for thousands of frames. Each frame is a PBM
+// image and an obs_data.txt file with the GT, CIRCLES and RECTS sections.
+//
+// Usage: bp_make_observation [--width 500] [--height 500] [--spiders 1]
+//          [--coverage 0.1] [--noise 0] [--frames 1] [--seed N] [--ascii]
+//          [--out data]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "../inference/common/spider_particle.h"
+
+using namespace BPSandbox;
+
+namespace
+{
+
+// Largest image side, 8K.
+const int MAX_SIZE = 8192;
+
+// Shape parameters, matching the Python generator.
+const float SPIDER_RADIUS = 10;
+const float LINK_WIDTH = 27;
+const float LINK_HEIGHT = 8;
+const float JOINT_STDDEV = 0.3;
+const float CIRCLE_MEAN = 10, CIRCLE_STDDEV = 2;
+const float RECT_WIDTH_STDDEV = 5, RECT_HEIGHT_STDDEV = 2;
+const int GRID_STEP = 40;
+
+// Spiders are kept this far from the border so they are fully in view.
+const int SPIDER_MARGIN = static_cast<int>(SPIDER_RADIUS + 4 * LINK_WIDTH) + 2;
+
+struct Options
+{
+  int width = 500;
+  int height = 500;
+  int spiders = 1;
+  int frames = 1;
+  double coverage = 0.1;
+  double noise = 0;
+  unsigned int seed = std::random_device{}();
+  bool ascii = false;
+  std::string out = "data";
+};
+
+/**
+ * A rendered frame. Shapes are stored in image (x, y) coordinates.
+ */
+struct Scene
+{
+  BitMask image;
+  spider::SpiderList spiders;
+  std::vector<spider::Circle> circles;
+  std::vector<spider::Rectangle> rects;
+  long long num_occupied = 0;
+};
+
+void usage()
+{
+  std::cerr << "Usage: bp_make_observation [--width W] [--height H] [--spiders N] [--coverage C]\n"
+            << "         [--noise P] [--frames F] [--seed S] [--ascii] [--out DIR]\n"
+            << "  --width, --height  Image size, up to " << MAX_SIZE << " (500x500).\n"
+            << "  --spiders          Number of spiders, the first being the target (1).\n"
+            << "  --coverage         Fraction of the image covered by blobs (0.1).\n"
+            << "  --noise            Probability of flipping each pixel (0).\n"
+            << "  --frames           Number of frames. Files are numbered if more than 1 (1).\n"
+            << "  --ascii            Write text P1 images instead of packed P4 ones.\n"
+            << "  --out              Output directory, which must exist (data).\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& opts)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--ascii")
+    {
+      opts.ascii = true;
+      continue;
+    }
+    if (arg == "--help" || i + 1 >= argc) return false;
+
+    const char* val = argv[++i];
+    if (arg == "--width") opts.width = atoi(val);
+    else if (arg == "--height") opts.height = atoi(val);
+    else if (arg == "--spiders") opts.spiders = atoi(val);
+    else if (arg == "--frames") opts.frames = atoi(val);
+    else if (arg == "--coverage") opts.coverage = atof(val);
+    else if (arg == "--noise") opts.noise = atof(val);
+    else if (arg == "--seed") opts.seed = strtoul(val, nullptr, 10);
+    else if (arg == "--out") opts.out = val;
+    else return false;
+  }
+
+  if (opts.width < 1 || opts.height < 1 || opts.width > MAX_SIZE || opts.height > MAX_SIZE)
+  {
+    std::cerr << "The image size must be between 1 and " << MAX_SIZE << "." << std::endl;
+    return false;
+  }
+  if (opts.spiders > 0 && std::min(opts.width, opts.height) <= 2 * SPIDER_MARGIN)
+  {
+    std::cerr << "The image is too small for a spider." << std::endl;
+    return false;
+  }
+
+  return opts.frames > 0 && opts.spiders >= 0 && opts.noise >= 0 && opts.noise <= 1;
+}
+
+/**
+ * Whether no pixel within a padding of the spans is set.
+ */
+bool isFree(const BitMask& mask, const SpanList& spans, const int pad)
+{
+  for (auto& s : spans)
+  {
+    int begin = s.begin - pad, end = s.end + pad;
+    for (int row = s.row - pad; row <= s.row + pad; ++row)
+    {
+      int first = begin >= 0 ? begin / 64 * 64 : (begin - 63) / 64 * 64;
+      for (int word_col = first; word_col < end; word_col += 64)
+      {
+        if (mask.word(word_col, row) & columnBits(word_col, begin, end)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Set the pixels of the spans, counting the ones which were free.
+ */
+long long draw(const SpanList& spans, BitMask& mask)
+{
+  long long added = 0;
+  for (auto& s : spans)
+  {
+    for (int col = std::max(s.begin, 0); col < std::min(s.end, mask.width()); ++col)
+    {
+      if (s.row < 0 || s.row >= mask.height() || mask.get(col, s.row)) continue;
+      mask.set(col, s.row);
+      added++;
+    }
+  }
+  return added;
+}
+
+spider::Rectangle makeRectangle(const float x, const float y, const float theta, const float w, const float h)
+{
+  spider::Rectangle r(x, y, theta, w, h);
+
+  float ux = cos(theta), uy = sin(theta);
+  float hw = r.width / 2, hh = r.height / 2;
+  r.setPoints({{x - ux * hw - uy * hh, y - uy * hw + ux * hh},
+               {x + ux * hw - uy * hh, y + uy * hw + ux * hh},
+               {x + ux * hw + uy * hh, y + uy * hw - ux * hh},
+               {x - ux * hw + uy * hh, y - uy * hw - ux * hh}});
+  return r;
+}
+
+Scene makeScene(const Options& opts, std::mt19937& gen)
+{
+  Scene scene;
+  scene.image.reset(0, 0, opts.width, opts.height);
+
+  // The spiders go first so the blobs never cover them.
+  std::uniform_real_distribution<float> x_dist(SPIDER_MARGIN, opts.width - SPIDER_MARGIN);
+  std::uniform_real_distribution<float> y_dist(SPIDER_MARGIN, opts.height - SPIDER_MARGIN);
+  std::normal_distribution<float> joint_dist(0, JOINT_STDDEV);
+
+  for (int i = 0; i < opts.spiders; ++i)
+  {
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+      std::vector<float> joints;
+      for (int j = 0; j < 4; ++j) joints.push_back(normalize_angle(j * PI / 2 + joint_dist(gen)));
+      for (int j = 0; j < 4; ++j) joints.push_back(joint_dist(gen));
+
+      spider::SpiderParticle s(x_dist(gen), y_dist(gen), SPIDER_RADIUS, LINK_WIDTH, LINK_HEIGHT, joints);
+      std::vector<SpanList> shapes = s.rasterize();
+
+      bool free = true;
+      for (auto& shape : shapes) free = free && isFree(scene.image, shape, 4);
+      if (!free) continue;
+
+      for (auto& shape : shapes) scene.num_occupied += draw(shape, scene.image);
+      scene.spiders.push_back(s);
+      break;
+    }
+  }
+
+  if (static_cast<int>(scene.spiders.size()) < opts.spiders)
+  {
+    std::cerr << "Only placed " << scene.spiders.size() << " spiders." << std::endl;
+  }
+
+  // Blobs are dropped near the cells of a grid, visited in random order,
+  // until enough of the image is covered.
+  const int cols = opts.width / GRID_STEP + 1, rows = opts.height / GRID_STEP + 1;
+  const float start_x = (opts.width % GRID_STEP) / 2.f, start_y = (opts.height % GRID_STEP) / 2.f;
+  std::vector<int> order(cols * rows);
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::shuffle(order.begin(), order.end(), gen);
+
+  std::normal_distribution<float> offset(0, 10);
+  std::uniform_real_distribution<float> unit(0, 1);
+  std::uniform_real_distribution<float> theta_dist(0, PI);
+  std::normal_distribution<float> radius_dist(CIRCLE_MEAN, CIRCLE_STDDEV);
+  std::normal_distribution<float> width_dist(LINK_WIDTH, RECT_WIDTH_STDDEV);
+  std::normal_distribution<float> height_dist(LINK_HEIGHT, RECT_HEIGHT_STDDEV);
+
+  const long long target = static_cast<long long>(opts.coverage * opts.width * opts.height);
+  // Give up if the image fills up before reaching the coverage.
+  const size_t max_attempts = order.size() * 20;
+
+  for (size_t attempt = 0; scene.num_occupied < target && attempt < max_attempts; ++attempt)
+  {
+    int cell = order[attempt % order.size()];
+    float x = offset(gen) + (cell % cols) * GRID_STEP + start_x;
+    float y = offset(gen) + (cell / cols) * GRID_STEP + start_y;
+
+    SpanList spans;
+    if (unit(gen) < 8.f / 9)
+    {
+      spider::Rectangle r = makeRectangle(x, y, theta_dist(gen), width_dist(gen), height_dist(gen));
+      r.spans(spans);
+      if (!isFree(scene.image, spans, 2)) continue;
+      scene.rects.push_back(r);
+    }
+    else
+    {
+      spider::Circle c(x, y, radius_dist(gen));
+      c.spans(spans);
+      if (!isFree(scene.image, spans, 4)) continue;
+      scene.circles.push_back(c);
+    }
+
+    scene.num_occupied += draw(spans, scene.image);
+  }
+
+  // Salt and pepper noise. Skipping ahead by geometric gaps visits only the
+  // flipped pixels.
+  if (opts.noise > 0)
+  {
+    std::geometric_distribution<long long> gap(opts.noise);
+    const long long num_pix = static_cast<long long>(opts.width) * opts.height;
+    for (long long i = gap(gen); i < num_pix; i += 1 + gap(gen))
+    {
+      int col = i % opts.width, row = i / opts.width;
+      if (scene.image.get(col, row)) scene.image.clear(col, row);
+      else scene.image.set(col, row);
+    }
+  }
+
+  return scene;
+}
+
+bool writeImage(const std::string& path, const BitMask& image, const bool ascii)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+
+  const int width = image.width(), height = image.height();
+  out << (ascii ? "P1" : "P4") << "\n" << width << " " << height << "\n";
+
+  if (ascii)
+  {
+    std::string line(2 * width, ' ');
+    line.back() = '\n';
+    for (int row = 0; row < height; ++row)
+    {
+      for (int col = 0; col < width; ++col) line[2 * col] = image.get(col, row) ? '1' : '0';
+      out.write(line.data(), line.size());
+    }
+  }
+  else
+  {
+    // Mask words hold the leftmost pixel in the lowest bit, and PBM bytes in
+    // the highest, so each byte is reversed through a table.
+    unsigned char reversed[256];
+    for (int b = 0; b < 256; ++b)
+    {
+      reversed[b] = 0;
+      for (int k = 0; k < 8; ++k) if (b & (1 << k)) reversed[b] |= 1 << (7 - k);
+    }
+
+    std::vector<char> line((width + 7) / 8);
+    for (int row = 0; row < height; ++row)
+    {
+      for (size_t k = 0; k < line.size(); ++k)
+      {
+        uint64_t word = image.word(k / 8 * 64, row);
+        line[k] = reversed[(word >> (8 * (k % 8))) & 0xFF];
+      }
+      out.write(line.data(), line.size());
+    }
+  }
+
+  return static_cast<bool>(out);
+}
+
+// The data file uses (row, col) coordinates, so angles are mirrored.
+void writeRect(std::ostream& out, const spider::Rectangle& r)
+{
+  out << r.y << " " << r.x << " " << normalize_angle(PI / 2 - r.theta) << " "
+      << r.width << " " << r.height << "\n";
+}
+
+void writeCircle(std::ostream& out, const spider::Circle& c)
+{
+  out << c.y << " " << c.x << " " << c.radius << "\n";
+}
+
+bool writeData(const std::string& path, const Scene& scene)
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) return false;
+  out.precision(10);
+
+  out << "GT\n";
+  for (auto& s : scene.spiders)
+  {
+    writeCircle(out, s.root);
+    for (auto& l : s.links) writeRect(out, l);
+  }
+
+  out << "CIRCLES\n";
+  for (auto& s : scene.spiders) writeCircle(out, s.root);
+  for (auto& c : scene.circles) writeCircle(out, c);
+
+  out << "RECTS\n";
+  for (auto& s : scene.spiders)
+  {
+    for (auto& l : s.links) writeRect(out, l);
+  }
+  for (auto& r : scene.rects) writeRect(out, r);
+
+  return static_cast<bool>(out);
+}
+
+std::string framePath(const Options& opts, const std::string& name, const int frame, const char* ext)
+{
+  if (opts.frames == 1) return opts.out + "/" + name + ext;
+
+  char num[16];
+  snprintf(num, sizeof(num), "_%04d", frame);
+  return opts.out + "/" + name + num + ext;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  Options opts;
+  if (!parseArgs(argc, argv, opts))
+  {
+    usage();
+    return 1;
+  }
+
+  std::mt19937 gen(opts.seed);
+  auto start = std::chrono::steady_clock::now();
+
+  for (int frame = 0; frame < opts.frames; ++frame)
+  {
+    Scene scene = makeScene(opts, gen);
+
+    std::string image_path = framePath(opts, "obs", frame, ".pbm");
+    std::string data_path = framePath(opts, "obs_data", frame, ".txt");
+    if (!writeImage(image_path, scene.image, opts.ascii) || !writeData(data_path, scene))
+    {
+      std::cerr << "Error writing " << image_path << std::endl;
+      return 1;
+    }
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "Wrote " << opts.frames << " frames of " << opts.width << "x" << opts.height
+            << " in " << elapsed.count() << "s (seed " << opts.seed << ")." << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef BP_SANDBOX_TEST_CHECK_H
+#define BP_SANDBOX_TEST_CHECK_H
+
+#include <cmath>
+#include <iostream>
+
+/**
+ * Minimal checks for the test programs. A failed check is reported and the
+ * test goes on, so one run shows every failure. Each test returns
+ * testResult() from main, which CTest reads as the outcome.
+ */
+
+inline int& testFailures()
+{
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                                       \
+  do                                                                                      \
+  {                                                                                       \
+    if (!(cond))                                                                          \
+    {                                                                                     \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl;  \
+      testFailures()++;                                                                   \
+    }                                                                                     \
+  } while (0)
+
+#define CHECK_NEAR(a, b, tol) CHECK(std::abs((a) - (b)) <= (tol))
+
+inline int testResult()
+{
+  if (testFailures() > 0) std::cerr << testFailures() << " checks failed." << std::endl;
+  return testFailures() > 0 ? 1 : 0;
+}
+
+#endif  // BP_SANDBOX_TEST_CHECK_H
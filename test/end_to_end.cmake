@@ -0,0 +1,26 @@
+# Generates scenes with bp_make_observation and checks that bp_evaluate
+# tracks the spider in them within a bounded pose error.
+#
+# Usage: cmake -DMAKE_OBSERVATION=... -DEVALUATE=... -DOUT_DIR=... -P end_to_end.cmake
+
+file(REMOVE_RECURSE ${OUT_DIR})
+file(MAKE_DIRECTORY ${OUT_DIR})
+
+execute_process(
+  COMMAND ${MAKE_OBSERVATION} --frames 4 --coverage 0.02 --seed 1 --out ${OUT_DIR}
+  RESULT_VARIABLE result
+)
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "bp_make_observation failed: ${result}")
+endif()
+
+# Clean scenes are tracked to well under a pixel, so a few pixels of mean
+# error means the filter is broken rather than unlucky.
+execute_process(
+  COMMAND ${EVALUATE} --generated ${OUT_DIR} 4 --particles 200 --likelihoods sdf --jitter 1
+          --runs 2 --max_error 3
+  RESULT_VARIABLE result
+)
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "bp_evaluate failed: ${result}")
+endif()
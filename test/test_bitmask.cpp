@@ -0,0 +1,117 @@
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "common/bitmask.h"
+#include "common/observation.h"
+#include "common/spider_particle.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+typedef std::set<std::pair<int, int> > PixelSet;
+
+/**
+ * Pixel-by-pixel intersection over union of a particle with the image, over
+ * the same window as SpiderParticle::iou().
+ */
+static double bruteForceIou(const spider::SpiderParticle& p, const Observation& obs)
+{
+  int sub_size = p.w * 4;
+  int start_x = std::max(0, static_cast<int>(std::floor(p.x - sub_size)));
+  int start_y = std::max(0, static_cast<int>(std::floor(p.y - sub_size)));
+  int end_x = std::min(static_cast<int>(obs.width), static_cast<int>(std::ceil(p.x + sub_size)));
+  int end_y = std::min(static_cast<int>(obs.height), static_cast<int>(std::ceil(p.y + sub_size)));
+
+  PixelSet shape;
+  for (auto& spans : p.rasterize())
+  {
+    for (auto& s : spans)
+    {
+      for (int col = s.begin; col < s.end; ++col) shape.insert({col, s.row});
+    }
+  }
+
+  int intersect = 0, uni = 0;
+  for (int row = start_y; row < end_y; ++row)
+  {
+    for (int col = start_x; col < end_x; ++col)
+    {
+      bool in_shape = shape.count({col, row}) > 0;
+      bool occupied = obs.isOccupied(col, row);
+      intersect += in_shape && occupied;
+      uni += in_shape || occupied;
+    }
+  }
+
+  return uni == 0 ? 0 : static_cast<double>(intersect) / uni;
+}
+
+int main()
+{
+  CHECK(popcount64(0) == 0);
+  CHECK(popcount64(~0ULL) == 64);
+  CHECK(popcount64(0x8000000000000001ULL) == 2);
+
+  CHECK(columnBits(0, 0, 64) == ~0ULL);
+  CHECK(columnBits(64, 0, 64) == 0);
+  CHECK(columnBits(64, 66, 70) == 0x3CULL);
+  CHECK(columnBits(0, 63, 200) == 1ULL << 63);
+
+  // A window starts on a multiple of 64 columns, also left of the image.
+  BitMask mask;
+  mask.reset(70, 5, 100, 10);
+  CHECK(mask.col0() == 64 && mask.width() == 106 && mask.wordsPerRow() == 2);
+  mask.reset(-10, 0, 20, 1);
+  CHECK(mask.col0() == -64 && mask.width() == 74);
+
+  mask.reset(70, 5, 100, 10);
+  mask.set(70, 5);
+  mask.set(169, 14);
+  mask.set(500, 5);
+  CHECK(mask.get(70, 5) && mask.get(169, 14) && !mask.get(500, 5) && !mask.get(71, 5));
+  mask.clear(70, 5);
+  CHECK(!mask.get(70, 5));
+
+  // Spans are clipped to the window, across word boundaries.
+  mask.setSpan(7, 60, 200);
+  for (int col = 60; col < 200; ++col) CHECK(mask.get(col, 7) == (col >= 64 && col < 170));
+  CHECK(mask.word(128, 7) == (1ULL << 42) - 1);
+  CHECK(mask.word(0, 7) == 0 && mask.word(192, 7) == 0 && mask.word(64, 4) == 0);
+
+  // IoU of a spider with images of itself, of a block, and of nothing.
+  std::vector<float> joints = {0.1f, 1.6f, 3.2f, 4.7f, 0.2f, -0.3f, 0.1f, 0.4f};
+  spider::SpiderParticle particle(157.3f, 143.6f, 10, 27, 8, joints);
+
+  std::vector<uint8_t> pixels(300 * 300, 0);
+  for (auto& spans : particle.rasterize())
+  {
+    for (auto& s : spans)
+    {
+      for (int col = s.begin; col < s.end; ++col) pixels[s.row * 300 + col] = 1;
+    }
+  }
+  Observation itself(pixels.data(), 300, 300);
+  CHECK_NEAR(particle.iou(itself), 1.0, 1e-12);
+
+  std::vector<uint8_t> block(300 * 300, 0);
+  for (int row = 100; row < 170; ++row)
+  {
+    for (int col = 130; col < 260; ++col) block[row * 300 + col] = 1;
+  }
+  Observation blocked(block.data(), 300, 300);
+  double iou = particle.iou(blocked);
+  CHECK(iou > 0 && iou < 1);
+  CHECK_NEAR(iou, bruteForceIou(particle, blocked), 1e-12);
+
+  std::vector<uint8_t> empty(300 * 300, 0);
+  Observation nothing(empty.data(), 300, 300);
+  CHECK(particle.iou(nothing) == 0);
+
+  // A spider hanging over the edge of the image.
+  spider::SpiderParticle edge(20.5f, 280.2f, 10, 27, 8, joints);
+  CHECK_NEAR(edge.iou(blocked), bruteForceIou(edge, blocked), 1e-12);
+  CHECK_NEAR(edge.iou(itself), bruteForceIou(edge, itself), 1e-12);
+
+  return testResult();
+}
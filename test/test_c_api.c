@@ -0,0 +1,90 @@
+/* The C interface, compiled as C to check the header stays C. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bp_inference.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                  \
+  do                                                                                 \
+  {                                                                                  \
+    if (!(cond))                                                                     \
+    {                                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);      \
+      failures++;                                                                    \
+    }                                                                                \
+  } while (0)
+
+#define WIDTH 240
+#define HEIGHT 200
+#define STRIDE 256
+
+int main(void)
+{
+  unsigned char* pixels = calloc(STRIDE * HEIGHT, 1);
+  bp_spider_pose pose;
+  bp_tracker* tracker;
+  int row, col, i, rc = 0;
+
+  /* A disc for the root, in rows padded past the width. */
+  for (row = 0; row < HEIGHT; ++row)
+  {
+    for (col = 0; col < WIDTH; ++col)
+    {
+      float dx = col - 120.f, dy = row - 90.f;
+      if (dx * dx + dy * dy <= 100) pixels[row * STRIDE + col] = 255;
+    }
+    /* The padding must be ignored. */
+    for (col = WIDTH; col < STRIDE; ++col) pixels[row * STRIDE + col] = 1;
+  }
+
+  /* Calls on nothing fail without crashing. */
+  CHECK(bp_tracker_set_image(NULL, pixels, WIDTH, HEIGHT, STRIDE) == -1);
+  CHECK(bp_tracker_init(NULL) == -1);
+  CHECK(bp_tracker_update(NULL) == -1);
+  CHECK(bp_tracker_estimate(NULL, &pose) == -1);
+  bp_tracker_destroy(NULL);
+
+  tracker = bp_tracker_create(100, NULL);
+  CHECK(tracker != NULL);
+  if (tracker == NULL) return 1;
+
+  /* Nothing to track before an image. */
+  CHECK(bp_tracker_init(tracker) == -1);
+  CHECK(bp_tracker_update(tracker) == -1);
+  CHECK(bp_tracker_estimate(tracker, &pose) == -1);
+  CHECK(bp_tracker_estimate(tracker, NULL) == -1);
+  CHECK(bp_tracker_set_image(tracker, NULL, WIDTH, HEIGHT, 0) == -1);
+  CHECK(bp_tracker_set_image(tracker, pixels, 0, HEIGHT, 0) == -1);
+
+  CHECK(bp_tracker_set_image(tracker, pixels, WIDTH, HEIGHT, STRIDE) == 0);
+  CHECK(bp_tracker_add_circle(tracker, 120, 90, 10) == 0);
+  CHECK(bp_tracker_add_rectangle(tracker, 160, 90, 0, 27, 8) == 0);
+  CHECK(bp_tracker_init(tracker) == 0);
+
+  for (i = 0; i < 30 && rc == 0; ++i) rc = bp_tracker_update(tracker);
+  CHECK(rc == 0 || rc == 1);
+
+  memset(&pose, 0, sizeof(pose));
+  CHECK(bp_tracker_estimate(tracker, &pose) == 0);
+  CHECK(pose.num_links == BP_MAX_LINKS);
+  CHECK(fabsf(pose.x - 120) < 4 && fabsf(pose.y - 90) < 4);
+  CHECK(pose.radius > 0);
+  CHECK(isfinite(pose.log_likelihood));
+
+  bp_tracker_destroy(tracker);
+
+  /* Unknown likelihoods fall back to the default. */
+  tracker = bp_tracker_create(10, "no such likelihood");
+  CHECK(tracker != NULL);
+  bp_tracker_destroy(tracker);
+
+  free(pixels);
+
+  if (failures > 0) fprintf(stderr, "%d checks failed.\n", failures);
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#include <random>
+#include <vector>
+
+#include "common/observation.h"
+#include "common/spider_particle.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+/**
+ * Every coarse score must bound the full score from above, at every level,
+ * or coarse-to-fine scoring prunes particles it should have kept.
+ */
+static void checkBounds(const spider::SpiderParticle& p, const Observation& obs)
+{
+  for (size_t level = 0; level < obs.pyramidLevels(); ++level)
+  {
+    CHECK(p.root.coarseSdf(obs, level) >= p.root.sdf(obs) - 1e-6);
+    for (auto& l : p.links) CHECK(l.coarseSdf(obs, level) >= l.sdf(obs) - 1e-6);
+    CHECK(p.coarseLikelihood(obs, level) >= p.jointUnaryLikelihood(obs) - 1e-6);
+  }
+}
+
+int main()
+{
+  const int width = 200, height = 150;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> unit(0, 1);
+
+  // Mostly occupied, so the score of a shape is close to its area and a bound
+  // which counts pixels outside the image as inside falls below it.
+  std::vector<uint8_t> pixels(width * height, 0);
+  for (auto& px : pixels) px = unit(gen) < 0.9f;
+  Observation obs(pixels.data(), width, height);
+
+  std::vector<float> joints(8);
+  for (int i = 0; i < 500; ++i)
+  {
+    for (auto& j : joints) j = 2 * PI * unit(gen);
+
+    // Up to a spider width outside the image on every side.
+    spider::SpiderParticle p(-60 + (width + 120) * unit(gen), -60 + (height + 120) * unit(gen),
+                             5 + 15 * unit(gen), 12 + 30 * unit(gen), 4 + 10 * unit(gen), joints);
+    checkBounds(p, obs);
+  }
+
+  // Centers on the border and in the corners.
+  spider::SpiderParticle corner(0, 0, 12, 30, 8, joints);
+  checkBounds(corner, obs);
+  spider::SpiderParticle edge(width - 0.5f, height / 2.f, 12, 30, 8, joints);
+  checkBounds(edge, obs);
+
+  // A fully occupied image is the tightest case.
+  std::vector<uint8_t> full(width * height, 1);
+  Observation filled(full.data(), width, height);
+  checkBounds(corner, filled);
+  checkBounds(edge, filled);
+
+  return testResult();
+}
@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+
+#include "json_view.h"
+#include "check.h"
+
+/**
+ * A view of a whole string, which must outlive the view.
+ */
+static JsonView view(const std::string& text)
+{
+  return JsonView(text.data(), text.data() + text.size());
+}
+
+int main()
+{
+  const std::string msg = " {\"action\": \"init\", \"num_particles\": 200, \"coarse_cutoff\": 2.5e1,\n"
+                          "  \"anneal\": true, \"early_stop\": false, \"nothing\": null,\n"
+                          "  \"observations\": [{\"image\": \"a.pbm\", \"data\": \"a.txt\"}, {\"image\": \"b.pbm\"}],\n"
+                          "  \"empty\": {}, \"path\": \"dir\\\\name \\\"quoted\\\"\\n\"} ";
+  JsonView root = view(msg);
+  CHECK(root.valid());
+  CHECK(root.isObject());
+  CHECK(root.size() == 9);
+
+  CHECK(root.get("action").equals("init"));
+  CHECK(!root.get("action").equals("ini"));
+  CHECK(root.get("action").asString() == "init");
+  CHECK(root.get("num_particles").asInt() == 200);
+  CHECK_NEAR(root.get("coarse_cutoff").asDouble(), 25.0, 1e-9);
+  CHECK(root.get("anneal").asBool());
+  CHECK(!root.get("early_stop").asBool(true));
+  CHECK(root.get("nothing").type() == JsonView::NUL);
+  CHECK(root.get("empty").isObject() && root.get("empty").size() == 0);
+  CHECK(root.get("path").asString() == "dir\\name \"quoted\"\n");
+
+  // Missing members are invalid and read as the defaults.
+  CHECK(!root.has("missing"));
+  CHECK(root.get("missing").asInt(7) == 7);
+  CHECK(root.get("missing").get("deeper").asDouble(1.5) == 1.5);
+
+  JsonView views = root.get("observations");
+  CHECK(views.isArray() && views.size() == 2);
+  CHECK(views.at(1).get("image").asString() == "b.pbm");
+  CHECK(!views.at(2).valid());
+
+  std::vector<std::string> images;
+  views.forEach([&images](const JsonView& v) { images.push_back(v.get("image").asString()); });
+  CHECK(images.size() == 2 && images[0] == "a.pbm" && images[1] == "b.pbm");
+
+  size_t members = 0;
+  root.forEachMember([&members](const JsonView& k, const JsonView& v) {
+    CHECK(k.isString() && v.valid());
+    members++;
+  });
+  CHECK(members == 9);
+
+  // Numbers of every form, and ints out of range.
+  const std::string numbers = "[-0.5, 1E3, 2e-2, 3.0, 1e20, -3e9, 2147483647, 1e99999]";
+  JsonView nums = view(numbers);
+  CHECK_NEAR(nums.at(0).asDouble(), -0.5, 1e-12);
+  CHECK_NEAR(nums.at(1).asDouble(), 1000.0, 1e-9);
+  CHECK_NEAR(nums.at(2).asDouble(), 0.02, 1e-12);
+  CHECK(nums.at(3).asInt() == 3);
+  CHECK(nums.at(4).asInt(-1) == -1);
+  CHECK(nums.at(5).asInt(-1) == -1);
+  CHECK(nums.at(6).asInt() == 2147483647);
+  CHECK(nums.at(7).asInt(-1) == -1);
+
+  // Malformed input gives an invalid view.
+  const char* bad[] = {"", "{", "{\"a\": }", "[1, 2", "\"open", "tru", "-", "{\"a\" 1}"};
+  for (auto& text : bad) CHECK(!view(text).valid());
+
+  return testResult();
+}
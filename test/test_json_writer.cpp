@@ -0,0 +1,100 @@
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json_view.h"
+#include "json_writer.h"
+#include "check.h"
+
+int main()
+{
+  // The exact text of a small message.
+  {
+    std::ostringstream out;
+    JsonWriter writer(out, 3);
+    writer.beginObject();
+    writer.key("a");
+    writer.value(1.5);
+    writer.key("b");
+    writer.array(std::vector<int>{1, -2, 3});
+    writer.key("c");
+    writer.boolean(false);
+    writer.key("d");
+    writer.value(-0.0001);
+    writer.endObject();
+    writer.flush();
+    CHECK(out.str() == "{\"a\":1.5,\"b\":[1,-2,3],\"c\":false,\"d\":0}");
+  }
+
+  // Everything written reads back the same.
+  const std::string awkward = std::string("tab\there, cr\r, quote \", slash \\, nl\n, bell\x07, nul") + '\0' + "end";
+  std::vector<double> many;
+  for (int i = 0; i < 2000; ++i) many.push_back(i * 0.25 - 100);
+
+  std::ostringstream out;
+  {
+    JsonWriter writer(out, 6);
+    writer.beginObject();
+    writer.key(awkward);
+    writer.value(awkward);
+    writer.key("numbers");
+    writer.beginArray();
+    writer.value(3.141592653);
+    writer.value(-2.5e-7);
+    writer.value(1e300);
+    writer.value(std::numeric_limits<double>::quiet_NaN());
+    writer.value(-std::numeric_limits<double>::infinity());
+    writer.endArray();
+    writer.key("many");
+    writer.array(many);
+    writer.key("nested");
+    writer.beginObject();
+    writer.key("list");
+    writer.beginArray();
+    writer.beginObject();
+    writer.endObject();
+    writer.value("x");
+    writer.endArray();
+    writer.endObject();
+    writer.endObject();
+    writer.flush();
+  }
+
+  const std::string text = out.str();
+  JsonView root(text.data(), text.data() + text.size());
+  CHECK(root.valid() && root.isObject());
+  CHECK(root.size() == 4);
+
+  // Control characters are escaped, so the text has none left.
+  for (auto& c : text) CHECK(static_cast<unsigned char>(c) >= 0x20);
+
+  bool found = false;
+  root.forEachMember([&](const JsonView& k, const JsonView& v) {
+    if (k.asString() != awkward) return;
+    found = true;
+    CHECK(v.asString() == awkward);
+  });
+  CHECK(found);
+
+  JsonView numbers = root.get("numbers");
+  CHECK(numbers.size() == 5);
+  CHECK_NEAR(numbers.at(0).asDouble(), 3.141593, 1e-9);
+  CHECK_NEAR(numbers.at(1).asDouble(), 0.0, 1e-9);
+  CHECK_NEAR(numbers.at(2).asDouble() / 1e300, 1.0, 1e-12);
+  CHECK(numbers.at(3).type() == JsonView::NUL);
+  CHECK(numbers.at(4).type() == JsonView::NUL);
+
+  JsonView read = root.get("many");
+  CHECK(read.size() == many.size());
+  size_t i = 0;
+  read.forEach([&](const JsonView& v) {
+    CHECK(i < many.size() && std::abs(v.asDouble() - many[i]) < 1e-9);
+    i++;
+  });
+
+  JsonView list = root.get("nested").get("list");
+  CHECK(list.size() == 2 && list.at(0).isObject() && list.at(1).asString() == "x");
+
+  return testResult();
+}
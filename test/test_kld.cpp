@@ -0,0 +1,48 @@
+#include <vector>
+
+#include "common/inference_utils.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+int main()
+{
+  // The upper 0.99 quantile of the standard normal, as the filter uses.
+  const double z = 2.326;
+  std::mt19937 gen(1);
+
+  // Fewer than two bins need a single sample.
+  CHECK(kldSampleSize(0, 0.05, z) == 1);
+  CHECK(kldSampleSize(1, 0.05, z) == 1);
+
+  // Values of the Wilson-Hilferty approximation.
+  CHECK(kldSampleSize(2, 0.05, z) == 66);
+  CHECK(kldSampleSize(11, 0.05, z) == 233);
+  CHECK(kldSampleSize(101, 0.05, z) == 1359);
+
+  // More bins need more samples, and a looser bound needs fewer.
+  for (size_t bins = 2; bins < 200; ++bins)
+  {
+    CHECK(kldSampleSize(bins + 1, 0.05, z) > kldSampleSize(bins, 0.05, z));
+    CHECK(kldSampleSize(bins, 0.1, z) < kldSampleSize(bins, 0.05, z));
+  }
+
+  // All the particles in one bin: the sample stops at the minimum.
+  std::vector<double> weights(100, 0.01);
+  std::vector<long long> one_bin(100, 7);
+  CHECK(kldSample(weights, one_bin, 10, 1000, 0.05, z, gen).size() == 10);
+
+  // Every particle in its own bin: the sample grows to the maximum.
+  std::vector<long long> own_bins;
+  for (long long i = 0; i < 100; ++i) own_bins.push_back(i);
+  CHECK(kldSample(weights, own_bins, 10, 50, 0.05, z, gen).size() == 50);
+
+  // Only particles with weight are drawn.
+  std::vector<double> one_weight(100, 0);
+  one_weight[42] = 1;
+  for (auto& idx : kldSample(one_weight, own_bins, 10, 50, 0.05, z, gen)) CHECK(idx == 42);
+
+  CHECK(kldSample(weights, own_bins, 10, 0, 0.05, z, gen).empty());
+
+  return testResult();
+}
@@ -0,0 +1,67 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "common/observation.h"
+#include "common/spider_particle.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+int main()
+{
+  CHECK(spider::LogSum().value() == 0);
+
+  // The batched logs match one log per factor, over the range of factors
+  // the likelihoods produce, including runs long enough to leave the float
+  // range many times.
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> exponent(-4, 1);
+  for (size_t n : {1, 2, 10, 100, 1000, 10000})
+  {
+    spider::LogSum batched;
+    double expected = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      float factor = static_cast<float>(std::pow(10.0, exponent(gen)));
+      batched.add(factor);
+      expected += std::log(factor);
+    }
+    CHECK_NEAR(batched.value(), expected, 1e-6 * n + 1e-6);
+  }
+
+  // Runs of the smallest and the largest factors.
+  spider::LogSum small, large;
+  for (int i = 0; i < 5000; ++i)
+  {
+    small.add(EPS);
+    large.add(1000);
+  }
+  CHECK_NEAR(small.value(), 5000 * std::log(static_cast<float>(EPS)), 1e-2);
+  CHECK_NEAR(large.value(), 5000 * std::log(1000.0), 1e-2);
+
+  // The SDF likelihood is the sum of the logs of its shape scores.
+  std::vector<uint8_t> pixels(300 * 300, 0);
+  for (int row = 120; row < 180; ++row)
+  {
+    for (int col = 100; col < 200; ++col) pixels[row * 300 + col] = 1;
+  }
+  Observation obs(pixels.data(), 300, 300);
+
+  std::vector<float> joints = {0.1f, 1.6f, 3.2f, 4.7f, 0.2f, -0.3f, 0.1f, 0.4f};
+  spider::SpiderParticle particle(150, 150, 10, 27, 8, joints);
+
+  double expected = 0;
+  SpanList spans;
+  particle.root.spans(spans);
+  expected += std::log(spider::spanSdf(obs, spans, particle.root.max_area));
+  for (auto& link : particle.links)
+  {
+    spans.clear();
+    link.spans(spans);
+    expected += std::log(spider::spanSdf(obs, spans, link.max_area));
+  }
+  CHECK_NEAR(particle.sdf(obs), expected, 1e-4);
+
+  return testResult();
+}
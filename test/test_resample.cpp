@@ -0,0 +1,82 @@
+#include <vector>
+
+#include "particle_filter.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+static bool samePose(const spider::SpiderParticle& a, const spider::SpiderParticle& b)
+{
+  return a.x == b.x && a.y == b.y && a.joints == b.joints;
+}
+
+/**
+ * A filter over a filled square, which scores every particle the same way on
+ * each update when nothing moves.
+ */
+static void setUp(ParticleFilter& pf, const Observation& obs, const double threshold, const float jitter)
+{
+  pf.setObservations({obs});
+  pf.setCoarseToFine(false, 0, 0);
+  pf.setConvergence(false, 0.5, 0.1, 5);
+  pf.setProposalRate(0);
+  pf.setJitter(jitter, jitter / 10, jitter / 10);
+  pf.setResampleThreshold(threshold);
+  pf.init(30, false);
+}
+
+int main()
+{
+  std::vector<uint8_t> pixels(200 * 200, 0);
+  for (int row = 60; row < 140; ++row)
+  {
+    for (int col = 60; col < 140; ++col) pixels[row * 200 + col] = 1;
+  }
+  Observation obs(pixels.data(), 200, 200);
+
+  // Without resampling, the particles keep their weight and each update adds
+  // its likelihood. Nothing moves, so the likelihood is the initial weight.
+  ParticleFilter kept;
+  setUp(kept, obs, 0, 0);
+  spider::SpiderList initial = kept.particles();
+  std::vector<double> initial_weights = kept.weights();
+  for (int step = 1; step <= 3; ++step)
+  {
+    kept.update();
+    CHECK(!kept.resampled());
+    CHECK(kept.particles().size() == initial.size());
+    for (size_t i = 0; i < kept.particles().size(); ++i)
+    {
+      bool found = false;
+      for (size_t j = 0; j < initial.size() && !found; ++j)
+      {
+        if (!samePose(kept.particles()[i], initial[j])) continue;
+        CHECK_NEAR(kept.weights()[i], (step + 1) * initial_weights[j], 1e-6);
+        found = true;
+      }
+      CHECK(found);
+    }
+  }
+
+  // The effective sample size is never above the number of particles.
+  ParticleFilter always;
+  setUp(always, obs, 1.01, 2);
+  for (int step = 0; step < 5; ++step)
+  {
+    always.update();
+    CHECK(always.resampled());
+  }
+
+  // Otherwise, resampling runs exactly when the effective sample size of the
+  // updated set, including the kept estimate, drops below the threshold.
+  ParticleFilter some;
+  setUp(some, obs, 0.5, 2);
+  for (int step = 0; step < 20; ++step)
+  {
+    size_t num_weights = some.particles().size() + 1;
+    some.update();
+    CHECK(some.resampled() == (some.effectiveSampleSize() < 0.5 * num_weights));
+  }
+
+  return testResult();
+}
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "particle_filter.h"
+#include "common/snapshot.h"
+#include "check.h"
+
+using namespace BPSandbox;
+
+static bool sameParticle(const spider::SpiderParticle& a, const spider::SpiderParticle& b)
+{
+  return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h && a.root.radius == b.root.radius &&
+         a.joints == b.joints && a.links[0].width == b.links[0].width &&
+         a.links[0].height == b.links[0].height;
+}
+
+int main()
+{
+  const std::string path = "test_snapshot.snapshot";
+
+  FilterSnapshot snapshot;
+  snapshot.update_count = 12;
+  snapshot.num_particles = 3;
+  // The links clamp their width to [12, 42], but the particle keeps its own.
+  const float widths[3] = {27, 8, 50};
+  for (int i = 0; i < 3; ++i)
+  {
+    std::vector<float> joints;
+    for (int j = 0; j < 8; ++j) joints.push_back(0.1f * i + 0.3f * j);
+    snapshot.particles.push_back(spider::SpiderParticle(10.5f + i, 20.25f - i, 9 + i, widths[i], 8, joints));
+    snapshot.weights.push_back(-1.5 * i);
+  }
+  snapshot.resampled = false;
+  snapshot.rng_state = "1 2 3";
+
+  CHECK(writeSnapshot(path, snapshot));
+
+  FilterSnapshot read;
+  CHECK(readSnapshot(path, read, 8));
+  CHECK(read.update_count == 12 && read.num_particles == 3);
+  CHECK(read.particles.size() == 3 && read.weights == snapshot.weights);
+  for (size_t i = 0; i < read.particles.size() && i < 3; ++i)
+  {
+    CHECK(sameParticle(read.particles[i], snapshot.particles[i]));
+  }
+  CHECK(!read.resampled && read.rng_state == snapshot.rng_state);
+
+  // Particles with another number of joints are refused.
+  CHECK(!readSnapshot(path, read, 6));
+
+  // So are missing, truncated and foreign files.
+  CHECK(!readSnapshot("test_snapshot.missing", read, 8));
+
+  std::string bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  const std::string truncated = "test_snapshot.truncated";
+  {
+    std::ofstream out(truncated, std::ios::binary);
+    out.write(bytes.data(), bytes.size() / 2);
+  }
+  CHECK(!readSnapshot(truncated, read, 8));
+
+  const std::string foreign = "test_snapshot.foreign";
+  {
+    std::ofstream out(foreign, std::ios::binary);
+    out << "P4\n500 500\n";
+  }
+  CHECK(!readSnapshot(foreign, read, 8));
+
+  // A filter loaded from a snapshot continues from the saved particles.
+  std::vector<uint8_t> pixels(200 * 200, 0);
+  for (int row = 80; row < 120; ++row)
+  {
+    for (int col = 80; col < 120; ++col) pixels[row * 200 + col] = 1;
+  }
+  Observation obs(pixels.data(), 200, 200);
+
+  ParticleFilter pf;
+  pf.setObservations({obs});
+  pf.init(20, false);
+  pf.update();
+  CHECK(pf.saveSnapshot(path));
+
+  ParticleFilter loaded;
+  loaded.setObservations({obs});
+  CHECK(loaded.loadSnapshot(path));
+  CHECK(loaded.updateCount() == pf.updateCount());
+  CHECK(loaded.weights() == pf.weights() && loaded.resampled() == pf.resampled());
+  CHECK(loaded.particles().size() == pf.particles().size());
+  for (size_t i = 0; i < loaded.particles().size() && i < pf.particles().size(); ++i)
+  {
+    CHECK(sameParticle(loaded.particles()[i], pf.particles()[i]));
+  }
+
+  std::shared_ptr<const FilterResults> results = loaded.published();
+  CHECK(results && results->update_count == pf.updateCount());
+  CHECK(results && results->particles->size() == pf.particles().size());
+
+  // The generator is restored too, so both filters take the same next step.
+  pf.update();
+  loaded.update();
+  CHECK(loaded.weights() == pf.weights());
+  CHECK(loaded.particles().size() == pf.particles().size());
+  for (size_t i = 0; i < loaded.particles().size() && i < pf.particles().size(); ++i)
+  {
+    CHECK(sameParticle(loaded.particles()[i], pf.particles()[i]));
+  }
+
+  std::remove(path.c_str());
+  std::remove(truncated.c_str());
+  std::remove(foreign.c_str());
+
+  return testResult();
+}